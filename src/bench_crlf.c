@@ -0,0 +1,169 @@
+/***********************************************************************/
+/* bench_crlf.c                                                        */
+/* ------------                                                        */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Microbenchmark of the CR / LF normalization kernels            */
+/*      Build and run with 'make bench'                                */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crlf.h"
+
+#define BENCH_SIZE (4 * 1024 * 1024)
+#define BENCH_CHUNK 8192
+#define BENCH_ROUNDS 20
+
+/* Text : lines of 40 to 100 characters ending with a lone LF */
+static void fill_text(gchar *data, gsize size)
+{
+    gsize i, next = 0;
+
+    for(i = 0; i < size; i++)
+    {
+	if(i == next)
+	{
+	    data[i] = '\n';
+	    next = i + 40 + rand() % 60;
+	}
+	else
+	    data[i] = ' ' + rand() % 95;
+    }
+}
+
+/* Line ends of every kind, LF, CR and CR LF, a few bytes apart : many
+   chunk boundaries fall between a CR and what follows it */
+static void fill_line_ends(gchar *data, gsize size)
+{
+    static const gchar chars[] = "\r\n\r\nab";
+    gsize i;
+
+    for(i = 0; i < size; i++)
+	data[i] = chars[rand() % (sizeof(chars) - 1)];
+}
+
+/* Binary : random bytes, so a CR or LF every 128 bytes on average */
+static void fill_binary(gchar *data, gsize size)
+{
+    gsize i;
+
+    for(i = 0; i < size; i++)
+	data[i] = rand() & 0xFF;
+}
+
+static void bench(const gchar *input_name, const gchar *data, gchar *out,
+		  const gchar *kernel_name, crlf_func_t kernel)
+{
+    GTimer *timer;
+    gsize offset, total = 0;
+    gdouble elapsed;
+    gint round, cr_received = 0;
+
+    timer = g_timer_new();
+    for(round = 0; round < BENCH_ROUNDS; round++)
+    {
+	/* Same chunks as the serial port reception */
+	for(offset = 0; offset < BENCH_SIZE; offset += BENCH_CHUNK)
+	    total += kernel(data + offset, BENCH_CHUNK, out, &cr_received);
+    }
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    printf("%-8s %-8s %8.1f MB/s  (%lu bytes out)\n", input_name, kernel_name,
+	   (gdouble)BENCH_SIZE * BENCH_ROUNDS / elapsed / (1024 * 1024),
+	   (unsigned long)total);
+}
+
+/* The whole input at once, then in chunks of random sizes, with the CR
+   state carried from one to the next : both must give the output of
+   the scalar kernel on the whole input */
+static void check(const gchar *input_name, const gchar *data, crlf_func_t kernel, const gchar *kernel_name)
+{
+    gchar *expected, *got;
+    gsize expected_size, got_size, offset, size;
+    gint cr_expected = 0, cr_got = 0;
+
+    expected = g_malloc(BENCH_SIZE * 2);
+    got = g_malloc(BENCH_SIZE * 2);
+    expected_size = crlf_convert_scalar(data, BENCH_SIZE, expected, &cr_expected);
+    got_size = kernel(data, BENCH_SIZE, got, &cr_got);
+    if(expected_size != got_size || memcmp(expected, got, expected_size) || cr_expected != cr_got)
+    {
+	fprintf(stderr, "%s : %s output differs from scalar output\n", input_name, kernel_name);
+	exit(EXIT_FAILURE);
+    }
+
+    got_size = 0;
+    cr_got = 0;
+    for(offset = 0; offset < BENCH_SIZE; offset += size)
+    {
+	/* mostly shorter than a vector, sometimes many of them */
+	size = (rand() % 4) ? 1 + rand() % 40 : 1 + rand() % BENCH_CHUNK;
+	size = MIN(size, BENCH_SIZE - offset);
+	got_size += kernel(data + offset, size, got + got_size, &cr_got);
+    }
+    if(expected_size != got_size || memcmp(expected, got, expected_size) || cr_expected != cr_got)
+    {
+	fprintf(stderr, "%s : %s output in chunks differs from scalar output\n", input_name, kernel_name);
+	exit(EXIT_FAILURE);
+    }
+
+    g_free(expected);
+    g_free(got);
+}
+
+int main(int argc, char *argv[])
+{
+    gchar *text, *binary, *line_ends, *out;
+    const gchar *name;
+
+    srand(1);
+    text = g_malloc(BENCH_SIZE);
+    binary = g_malloc(BENCH_SIZE);
+    line_ends = g_malloc(BENCH_SIZE);
+    out = g_malloc(BENCH_CHUNK * 2);
+    fill_text(text, BENCH_SIZE);
+    fill_binary(binary, BENCH_SIZE);
+    fill_line_ends(line_ends, BENCH_SIZE);
+
+    crlf_get_kernel(&name);
+    printf("Kernel selected at run time : %s\n", name);
+
+    bench("text", text, out, "scalar", crlf_convert_scalar);
+    bench("binary", binary, out, "scalar", crlf_convert_scalar);
+    check("line ends", line_ends, crlf_convert_scalar, "scalar");
+#ifdef HAVE_CRLF_SIMD
+    if(__builtin_cpu_supports("sse2"))
+    {
+	check("text", text, crlf_convert_sse2, "sse2");
+	check("binary", binary, crlf_convert_sse2, "sse2");
+	check("line ends", line_ends, crlf_convert_sse2, "sse2");
+	bench("text", text, out, "sse2", crlf_convert_sse2);
+	bench("binary", binary, out, "sse2", crlf_convert_sse2);
+    }
+    if(__builtin_cpu_supports("avx2"))
+    {
+	check("text", text, crlf_convert_avx2, "avx2");
+	check("binary", binary, crlf_convert_avx2, "avx2");
+	check("line ends", line_ends, crlf_convert_avx2, "avx2");
+	bench("text", text, out, "avx2", crlf_convert_avx2);
+	bench("binary", binary, out, "avx2", crlf_convert_avx2);
+    }
+#endif
+
+    g_free(text);
+    g_free(binary);
+    g_free(line_ends);
+    g_free(out);
+
+    return 0;
+}
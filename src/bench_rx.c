@@ -0,0 +1,324 @@
+/***********************************************************************/
+/* bench_rx.c                                                          */
+/* ----------                                                          */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Benchmark of the receive path on a pseudo terminal pair :      */
+/*      the real Config_port() / Lis_port() / buffer code, fed at      */
+/*      maximum rate, in the ASCII, hexadecimal, CR LF auto and        */
+/*      logging variants. Build and run with 'make bench'              */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <pthread.h>
+#include <pty.h>
+#include <time.h>
+
+#include "term_config.h"
+#include "serie.h"
+#include "buffer.h"
+#include "crlf.h"
+#include "hexview.h"
+#include "logging.h"
+#include "widgets.h"
+
+#define BENCH_FRAME_USEC (G_USEC_PER_SEC / DEFAULT_REFRESH_RATE)
+
+/* Symbols of the GUI used by the receive path */
+struct configuration_port config;
+GtkWidget *Fenetre = NULL;
+gboolean waiting_for_char = FALSE;
+
+void Set_local_echo(gboolean echo) {}
+void add_input(void) {}
+void show_control_signals(int stat) {}
+void show_port_counters(void) {}
+void toggle_logging_pause_resume(gboolean currentlyLogging) {}
+void toggle_logging_sensitivity(gboolean currentlyLogging) {}
+
+void show_message(gchar *message, gint type_msg)
+{
+    fprintf(stderr, "%s\n", message);
+}
+
+void Put_temp_message(const gchar *message, gint time)
+{
+    fprintf(stderr, "%s\n", message);
+}
+
+/* Benchmark state */
+static int master_fd;
+static gchar *pattern;
+static gsize total_size = 64 * 1024 * 1024;
+static gsize chunk_size = 4096;
+static guint chunk_count;
+static gint64 *sent_time;
+static gint64 *latency;
+static gsize received;
+static guint chunks_done;
+
+/* Display side, as in widgets.c but without VTE : the staging buffer
+   is dropped once per frame */
+static GString *staging;
+static gint64 last_frame;
+static gint staging_cr_received;
+static hex_state_t hex_view;
+
+/* The report has its own copy of stdout, which goes to /dev/null */
+static FILE *report;
+
+static gint64 now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static gint64 thread_cpu_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static void account(gsize size)
+{
+    gint64 now = now_usec();
+
+    received += size;
+    while(chunks_done < chunk_count && received >= (gsize)(chunks_done + 1) * chunk_size)
+    {
+	latency[chunks_done] = now - sent_time[chunks_done];
+	chunks_done++;
+    }
+
+    if(now - last_frame >= BENCH_FRAME_USEC)
+    {
+	g_string_truncate(staging, 0);
+	last_frame = now;
+    }
+}
+
+static void bench_text(gchar *string, guint size)
+{
+    gsize length = staging->len;
+
+    if(config.crlfauto)
+    {
+	g_string_set_size(staging, length + size * 2);
+	g_string_truncate(staging, length + crlf_convert(string, size, staging->str + length, &staging_cr_received));
+    }
+    else
+	g_string_append_len(staging, string, size);
+
+    account(size);
+}
+
+static void bench_hexadecimal(gchar *string, guint size)
+{
+    hex_format(&hex_view, (guchar *)string, size, staging);
+    account(size);
+}
+
+/* Writes the pattern at maximum rate, one chunk at a time. The time is
+   taken before the write, so the latency includes the time spent
+   waiting for room in the pseudo terminal */
+static void *producer(void *data)
+{
+    gsize offset, written;
+    gssize result;
+    guint i;
+
+    for(i = 0; i < chunk_count; i++)
+    {
+	offset = (gsize)i * chunk_size % total_size;
+	sent_time[i] = now_usec();
+	for(written = 0; written < chunk_size; written += result)
+	{
+	    result = write(master_fd, pattern + offset + written, chunk_size - written);
+	    if(result == -1)
+	    {
+		if(errno == EINTR)
+		{
+		    result = 0;
+		    continue;
+		}
+		perror("bench write");
+		return NULL;
+	    }
+	}
+    }
+
+    return NULL;
+}
+
+static int compare_gint64(const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void run(const gchar *name, void (*display)(gchar *, guint), gboolean crlfauto, const gchar *log_file)
+{
+    pthread_t thread;
+    gint64 start, elapsed, cpu;
+
+    config.crlfauto = crlfauto;
+    if(log_file != NULL && !logging_start_file((gchar *)log_file))
+	return;
+
+    g_string_truncate(staging, 0);
+    staging_cr_received = 0;
+    hex_init(&hex_view, 16, FALSE);
+    clear_buffer();
+    set_display_func(display);
+    received = 0;
+    chunks_done = 0;
+
+    start = now_usec();
+    cpu = thread_cpu_usec();
+    if(pthread_create(&thread, NULL, producer, NULL) != 0)
+    {
+	perror("bench producer");
+	return;
+    }
+    while(chunks_done < chunk_count)
+	g_main_context_iteration(NULL, TRUE);
+    elapsed = now_usec() - start;
+    cpu = thread_cpu_usec() - cpu;
+    pthread_join(thread, NULL);
+
+    if(log_file != NULL)
+    {
+	logging_stop();
+	unlink(log_file);
+    }
+
+    qsort(latency, chunk_count, sizeof(gint64), compare_gint64);
+    fprintf(report, "%-10s %8.1f MB/s  latency p50 %6ld p90 %6ld p99 %6ld max %7ld us  "
+	   "cpu %5.1f ms/MB\n",
+	   name,
+	   (gdouble)received / elapsed * G_USEC_PER_SEC / (1024 * 1024),
+	   (long)latency[chunk_count / 2],
+	   (long)latency[chunk_count * 9 / 10],
+	   (long)latency[chunk_count * 99 / 100],
+	   (long)latency[chunk_count - 1],
+	   (gdouble)cpu / 1000 / ((gdouble)received / (1024 * 1024)));
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: bench_rx [-s size in MB] [-c chunk size] [-p text | binary]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int slave_fd, c;
+    gchar *log_file;
+    gboolean text = TRUE;
+    gsize i, next = 0;
+
+    while((c = getopt(argc, argv, "s:c:p:h")) != -1)
+    {
+	switch(c)
+	{
+	    case 's':
+		total_size = (gsize)atoi(optarg) * 1024 * 1024;
+		break;
+	    case 'c':
+		chunk_size = atoi(optarg);
+		break;
+	    case 'p':
+		text = strcmp(optarg, "binary") != 0;
+		break;
+	    default:
+		usage();
+		return EXIT_FAILURE;
+	}
+    }
+    if(total_size == 0 || chunk_size == 0 || chunk_size > total_size)
+    {
+	usage();
+	return EXIT_FAILURE;
+    }
+    total_size -= total_size % chunk_size;
+    chunk_count = total_size / chunk_size;
+
+    /* The pattern : lines of 40 to 100 characters, or random bytes */
+    pattern = g_malloc(total_size);
+    srand(1);
+    for(i = 0; i < total_size; i++)
+    {
+	if(!text)
+	    pattern[i] = rand() & 0xFF;
+	else if(i == next)
+	{
+	    pattern[i] = '\n';
+	    next = i + 40 + rand() % 60;
+	}
+	else
+	    pattern[i] = ' ' + rand() % 95;
+    }
+    sent_time = g_new(gint64, chunk_count);
+    latency = g_new(gint64, chunk_count);
+    staging = g_string_sized_new(BUFFER_RECEPTION * 4);
+
+    if(openpty(&master_fd, &slave_fd, NULL, NULL, NULL) == -1)
+    {
+	perror("openpty");
+	return EXIT_FAILURE;
+    }
+
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if(report == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+	perror("bench report");
+	return EXIT_FAILURE;
+    }
+    setvbuf(report, NULL, _IOLBF, 0);
+
+    memset(&config, 0, sizeof(config));
+    g_strlcpy(config.port, ttyname(slave_fd), sizeof(config.port));
+    config.vitesse = 115200;
+    config.bits = 8;
+    config.stops = 1;
+    config.car = -1;
+    config.buffer_size = DEFAULT_BUFFER_SIZE;
+
+    create_buffer();
+    if(Config_port() == FALSE)
+	return EXIT_FAILURE;
+
+    fprintf(report, "%lu MB of %s data in chunks of %lu bytes on %s\n",
+	   (unsigned long)(total_size / (1024 * 1024)), text ? "text" : "binary",
+	   (unsigned long)chunk_size, config.port);
+
+    log_file = g_build_filename(g_get_tmp_dir(), "bench_rx.log", NULL);
+    run("ascii", bench_text, FALSE, NULL);
+    run("hex", bench_hexadecimal, FALSE, NULL);
+    run("crlf-auto", bench_text, TRUE, NULL);
+    run("logging", bench_text, FALSE, log_file);
+
+    Close_port_and_remove_lockfile();
+    close(slave_fd);
+    close(master_fd);
+    delete_buffer();
+    g_free(log_file);
+
+    return EXIT_SUCCESS;
+}
@@ -17,143 +17,285 @@
 /*                                                                     */
 /***********************************************************************/
 
+#include <gtk/gtk.h>
 #include <glib.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include "buffer.h"
 #include "i18n.h"
 #include "serie.h"
+#include "logging.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
 
-static char *buffer = NULL;
-static char *current_buffer;
-static unsigned int pointer;
-static int cr_received = 0;
-char overlapped;
+/* The history is a list of segments, oldest first. When the cap is
+   reached, the oldest segment is recycled to receive the new data */
+typedef struct {
+    gchar *data;
+    gsize used;
+} segment_t;
+
+static GQueue *segments = NULL;
+static GQueue *free_segments = NULL;
+static segment_t *spare = NULL;
+static guint max_segments = DEFAULT_BUFFER_SIZE * 1024 * 1024 / BUFFER_SEGMENT_SIZE;
+
+/* Bytes received, and bytes copied in user space on their way to the
+   display (redraws of the history are not counted) */
+static guint64 bytes_received = 0;
+static guint64 bytes_copied = 0;
+static gboolean replaying = FALSE;
 
 void (*write_func)(char *, unsigned int) = NULL;
 void (*clear_func)(void) = NULL;
 
 void create_buffer(void)
 {
-  if(buffer == NULL)
+  if(segments == NULL)
     {
-      buffer = malloc(BUFFER_SIZE);
+      segments = g_queue_new();
+      free_segments = g_queue_new();
       clear_buffer();
     }
   return;
 }
 
+static void free_segment(segment_t *segment)
+{
+  g_free(segment->data);
+  g_free(segment);
+}
+
 void delete_buffer(void)
 {
-  if(buffer != NULL)
-    free(buffer);
-  return;
+  segment_t *segment;
+
+  if(segments == NULL)
+    return;
+
+  while((segment = g_queue_pop_head(segments)) != NULL)
+    free_segment(segment);
+  while((segment = g_queue_pop_head(free_segments)) != NULL)
+    free_segment(segment);
+  if(spare != NULL)
+    free_segment(spare);
+  spare = NULL;
+  g_queue_free(segments);
+  g_queue_free(free_segments);
+  segments = NULL;
+  free_segments = NULL;
 }
 
-void put_chars(char *chars, unsigned int size, gboolean crlf_auto)
+/* Sets the cap of the history, in bytes. When shrinking, the oldest
+   data is dropped. At least two segments are kept, so that the spare
+   segment is never the one being filled */
+void set_buffer_size(gsize size)
 {
-    char *characters;
- 
-    /* If the auto CR LF mode on, read the buffer to add \r before \n */ 
-    if(crlf_auto)
+  max_segments = MAX(size / BUFFER_SEGMENT_SIZE, 2);
+
+  if(segments == NULL)
+    return;
+
+  while(g_queue_get_length(segments) > max_segments)
+    free_segment(g_queue_pop_head(segments));
+  while(g_queue_get_length(segments) + g_queue_get_length(free_segments) > max_segments)
+    free_segment(g_queue_pop_head(free_segments));
+}
+
+/* Gets an empty segment : a cleared one if any, a new one while under
+   the cap, else the oldest one of the history */
+static segment_t *take_segment(void)
+{
+  segment_t *segment;
+
+  segment = g_queue_pop_head(free_segments);
+  if(segment == NULL)
     {
-	/* BUFFER_RECEPTION*2 for worst case scenario, all \n or \r chars */
-	char out_buffer[BUFFER_RECEPTION*2];
-	int i, out_size = 0;
-      
-	for (i=0; i<size; i++)
-        {
-	    if (chars[i] == '\r')
-            {
-		/* If the previous character was a CR too, insert a newline */
-		if (cr_received)
-                {
-		    out_buffer[out_size] = '\n';
-		    out_size++;
-                }
-		cr_received = 1;
-            }
-	    else
-            {
-		if (chars[i] == '\n')
-                {
-		    /* If we get a newline without a CR first, insert a CR */
-		    if (!cr_received)
-                    {
-			out_buffer[out_size] = '\r';
-			out_size++;
-                    }
-                }
-		else
-                {
-		    /* If we receive a normal char, and the previous one was a
-		       CR insert a newline */
-		    if (cr_received)
-                    {
-			out_buffer[out_size] = '\n';
-			out_size++;
-                    }
-                }
-		cr_received = 0;
-            }
-	    out_buffer[out_size] = chars[i];
-	    out_size++;
-        }
-	chars = out_buffer;
-	size = out_size;
+      if(g_queue_get_length(segments) < max_segments)
+	{
+	  segment = g_new(segment_t, 1);
+	  segment->data = g_malloc(BUFFER_SEGMENT_SIZE);
+	}
+      else
+	segment = g_queue_pop_head(segments);
     }
+  segment->used = 0;
 
-    if(buffer == NULL)
+  return segment;
+}
+
+/* Appends an empty segment to the history. The spare segment is kept
+   out of the cap : the oldest segment is only recycled once data has
+   landed in the spare, and then becomes the next spare */
+static segment_t *next_segment(void)
+{
+  segment_t *segment;
+
+  if(spare != NULL)
+    {
+      segment = spare;
+      spare = NULL;
+      g_queue_push_tail(segments, segment);
+      if(g_queue_get_length(segments) > max_segments)
+	{
+	  spare = g_queue_pop_head(segments);
+	  spare->used = 0;
+	}
+    }
+  else
+    {
+      segment = take_segment();
+      g_queue_push_tail(segments, segment);
+    }
+
+  return segment;
+}
+
+/* Zero copy reception : returns up to BUFFER_REGIONS free regions, for
+   'size' bytes at most, where the data can be read in place. The data
+   is added to the history by buffer_commit() */
+gint buffer_get_free_regions(struct iovec *regions, gsize size)
+{
+  segment_t *segment;
+  gint count = 0;
+
+  if(segments == NULL)
+    return 0;
+
+  /* First the end of the last segment... */
+  segment = g_queue_peek_tail(segments);
+  if(segment != NULL && segment->used < BUFFER_SEGMENT_SIZE)
+    {
+      regions[count].iov_base = segment->data + segment->used;
+      regions[count].iov_len = MIN(size, BUFFER_SEGMENT_SIZE - segment->used);
+      size -= regions[count].iov_len;
+      count++;
+    }
+
+  /* ...then the segment that will follow it */
+  if(size > 0)
+    {
+      if(spare == NULL)
+	{
+	  /* Never at the expense of the history : readv() may well
+	     fill the first region only */
+	  spare = g_queue_pop_head(free_segments);
+	  if(spare == NULL)
+	    {
+	      spare = g_new(segment_t, 1);
+	      spare->data = g_malloc(BUFFER_SEGMENT_SIZE);
+	    }
+	  spare->used = 0;
+	}
+      regions[count].iov_base = spare->data;
+      regions[count].iov_len = MIN(size, BUFFER_SEGMENT_SIZE);
+      count++;
+    }
+
+  return count;
+}
+
+/* Adds 'size' bytes read in the regions to the history, and hands them
+   to the log and to the display where they are */
+void buffer_commit(gsize size)
+{
+  segment_t *segment;
+  gsize length;
+
+  bytes_received += size;
+  segment = g_queue_peek_tail(segments);
+  while(size > 0)
+    {
+      if(segment == NULL || segment->used == BUFFER_SEGMENT_SIZE)
+	segment = next_segment();
+
+      length = MIN(size, BUFFER_SEGMENT_SIZE - segment->used);
+      log_chars(segment->data + segment->used, length);
+      if(write_func != NULL)
+	write_func(segment->data + segment->used, length);
+      segment->used += length;
+      size -= length;
+    }
+}
+
+void buffer_count_copy(gsize size)
+{
+  if(!replaying)
+    bytes_copied += size;
+}
+
+gchar *get_copy_stats(void)
+{
+  return g_strdup_printf(_("%llu bytes received, %llu bytes copied (%.2f copies per byte)"),
+			 (unsigned long long)bytes_received,
+			 (unsigned long long)bytes_copied,
+			 bytes_received ? (gdouble)bytes_copied / bytes_received : 0.0);
+}
+
+void put_chars(char *chars, unsigned int size)
+{
+    char *characters;
+    segment_t *segment;
+    gsize length, copied;
+
+    if(segments == NULL)
     {
 	i18n_printf(_("ERROR : Buffer is not initialized !\n"));
 	return;
     }
-   
-    if(size > BUFFER_SIZE)
+
+    /* the log gets all of it, whatever the view */
+    log_chars(chars, size);
+
+    if(size > (gsize)max_segments * BUFFER_SEGMENT_SIZE)
     {
-	characters = chars + (size - BUFFER_SIZE);
-	size = BUFFER_SIZE;
+	characters = chars + (size - max_segments * BUFFER_SEGMENT_SIZE);
+	size = max_segments * BUFFER_SEGMENT_SIZE;
     }
     else
 	characters = chars;
- 
-    if((size + pointer) >= BUFFER_SIZE)
-    {
-	memcpy(current_buffer, characters, BUFFER_SIZE - pointer);
-	chars = characters + BUFFER_SIZE - pointer;
-	pointer = size - (BUFFER_SIZE - pointer);
-	memcpy(buffer, chars, pointer);
-	current_buffer = buffer + pointer;
-	overlapped = 1;
-    }
-    else
+
+    bytes_received += size;
+    buffer_count_copy(size);
+    chars = characters;
+    length = size;
+    while(length > 0)
     {
-	memcpy(current_buffer, characters, size);
-	pointer += size;
-	current_buffer += size;
+	segment = g_queue_peek_tail(segments);
+	if(segment == NULL || segment->used == BUFFER_SEGMENT_SIZE)
+	    segment = next_segment();
+
+	copied = MIN(length, BUFFER_SEGMENT_SIZE - segment->used);
+	memcpy(segment->data + segment->used, chars, copied);
+	segment->used += copied;
+	chars += copied;
+	length -= copied;
     }
-   
+
   if(write_func != NULL)
   {
     write_func(characters, size);
   }
 }
 
+/* Walks the history in order, without copying it */
 void write_buffer(void)
 {
-  if(write_func == NULL)
+  GList *list;
+  segment_t *segment;
+
+  if(write_func == NULL || segments == NULL)
     return;
 
-  if(overlapped == 0)
-    write_func(buffer, pointer);
-  else
+  replaying = TRUE;
+  for(list = segments->head; list != NULL; list = list->next)
     {
-      write_func(current_buffer, BUFFER_SIZE - pointer);
-      write_func(buffer, pointer);
+      segment = list->data;
+      write_func(segment->data, segment->used);
     }
+  replaying = FALSE;
 }
 
 void write_buffer_with_func(void (*func)(char *, unsigned int))
@@ -168,17 +310,17 @@ void write_buffer_with_func(void (*func)(char *, unsigned int))
 
 void clear_buffer(void)
 {
+  segment_t *segment;
+
   if(clear_func != NULL)
     clear_func();
 
-  if(buffer == NULL)
+  if(segments == NULL)
     return;
 
-  overlapped = 0;
-  memset(buffer, 0, BUFFER_SIZE);
-  current_buffer = buffer;
-  pointer = 0;
-  cr_received = 0;
+  /* Keep the segments for the data to come */
+  while((segment = g_queue_pop_head(segments)) != NULL)
+    g_queue_push_tail(free_segments, segment);
 }
 
 void set_clear_func(void (*func)(void))
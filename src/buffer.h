@@ -19,11 +19,23 @@
 #ifndef BUFFER_H_
 #define BUFFER_H_
 
-#define BUFFER_SIZE (128 * 1024)
+#include <sys/uio.h>
+
+/* The history is kept in segments of BUFFER_SEGMENT_SIZE bytes, up to
+   the buffer size, set in MB */
+#define BUFFER_SEGMENT_SIZE (1024 * 1024)
+#define DEFAULT_BUFFER_SIZE 16
+#define MAX_BUFFER_SIZE (64 * 1024)
+#define BUFFER_REGIONS 2
 
 void create_buffer(void);
 void delete_buffer(void);
-void put_chars(char *, unsigned int, gboolean);
+void set_buffer_size(gsize);
+void put_chars(char *, unsigned int);
+gint buffer_get_free_regions(struct iovec *, gsize);
+void buffer_commit(gsize);
+void buffer_count_copy(gsize);
+gchar *get_copy_stats(void);
 void clear_buffer(void);
 void write_buffer(void);
 void set_display_func(void (*func)(char *, unsigned int));
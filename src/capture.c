@@ -0,0 +1,326 @@
+/***********************************************************************/
+/* capture.c                                                           */
+/* ---------                                                           */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Capture of the data received and sent : each chunk             */
+/*      is a record with its time, direction and the modem             */
+/*      lines. The records are encoded into a buffer which             */
+/*      a thread writes to the file                                    */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "capture.h"
+#include "i18n.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+#define CAPTURE_MAX_PAYLOAD (64 * 1024)
+
+/* Double buffer : the records are encoded into capture_fill, from any
+   thread. The full buffer is handed to the writer thread as
+   capture_pending, while the other one is filled. When the writer is
+   still busy with the previous one, the new records are dropped rather
+   than waited for */
+static int capture_fd = -1;
+static gint capture_format = CAPTURE_NATIVE;
+static volatile gint capture_on = 0;
+static gint64 capture_real_offset = 0;
+static pthread_t capture_thread;
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t capture_work = PTHREAD_COND_INITIALIZER;
+static gboolean capture_quit = FALSE;
+static gchar *capture_fill = NULL;
+static gsize capture_fill_used = 0;
+static gchar *capture_free = NULL;
+static gchar *capture_pending = NULL;
+static gsize capture_pending_used = 0;
+static guint64 capture_dropped = 0;
+static gint capture_errno = 0;
+
+static gchar *put_16(gchar *out, guint16 value)
+{
+    value = GUINT16_TO_LE(value);
+    memcpy(out, &value, 2);
+    return out + 2;
+}
+
+static gchar *put_32(gchar *out, guint32 value)
+{
+    value = GUINT32_TO_LE(value);
+    memcpy(out, &value, 4);
+    return out + 4;
+}
+
+static gchar *put_64(gchar *out, guint64 value)
+{
+    value = GUINT64_TO_LE(value);
+    memcpy(out, &value, 8);
+    return out + 8;
+}
+
+/* Called with capture_lock held */
+static void capture_hand_over(void)
+{
+    capture_pending = capture_fill;
+    capture_pending_used = capture_fill_used;
+    capture_fill = capture_free;
+    capture_fill_used = 0;
+    capture_free = NULL;
+    pthread_cond_signal(&capture_work);
+}
+
+static void capture_write(const gchar *data, gsize size)
+{
+    gssize written;
+    gsize done = 0;
+
+    while(done < size && capture_errno == 0)
+    {
+	written = write(capture_fd, data + done, size - done);
+	if(written == -1 && errno == EINTR)
+	    continue;
+	if(written <= 0)
+	{
+	    capture_errno = (written == -1) ? errno : ENOSPC;
+	    break;
+	}
+	done += written;
+    }
+}
+
+static void *capture_main(void *data)
+{
+    struct timespec deadline;
+    gchar *buffer;
+    gsize used;
+    gint64 now;
+
+    pthread_mutex_lock(&capture_lock);
+    while(1)
+    {
+	if(capture_pending == NULL)
+	{
+	    if(capture_quit == TRUE && capture_fill_used == 0)
+		break;
+
+	    /* what is in capture_fill is written within CAPTURE_FLUSH_MS */
+	    if(capture_quit == FALSE)
+	    {
+		now = g_get_real_time() + CAPTURE_FLUSH_MS * 1000;
+		deadline.tv_sec = now / G_USEC_PER_SEC;
+		deadline.tv_nsec = (now % G_USEC_PER_SEC) * 1000;
+		if(pthread_cond_timedwait(&capture_work, &capture_lock, &deadline) == 0)
+		    continue;
+	    }
+	    if(capture_fill_used == 0)
+		continue;
+	    capture_hand_over();
+	}
+
+	buffer = capture_pending;
+	used = capture_pending_used;
+	capture_pending = NULL;
+	pthread_mutex_unlock(&capture_lock);
+
+	capture_write(buffer, used);
+
+	pthread_mutex_lock(&capture_lock);
+	capture_free = buffer;
+    }
+    pthread_mutex_unlock(&capture_lock);
+
+    return NULL;
+}
+
+/* Section header and interface description blocks */
+static void capture_pcapng_header(void)
+{
+    gchar header[60], *out = header;
+
+    out = put_32(out, 0x0A0D0D0A);
+    out = put_32(out, 28);
+    out = put_32(out, 0x1A2B3C4D);
+    out = put_16(out, 1);
+    out = put_16(out, 0);
+    out = put_64(out, G_MAXUINT64);
+    out = put_32(out, 28);
+
+    out = put_32(out, 1);
+    out = put_32(out, 32);
+    out = put_16(out, CAPTURE_LINKTYPE);
+    out = put_16(out, 0);
+    out = put_32(out, 0);
+    /* if_tsresol : microseconds */
+    out = put_16(out, 9);
+    out = put_16(out, 1);
+    out = put_32(out, 6);
+    out = put_32(out, 0);
+    out = put_32(out, 32);
+
+    capture_write(header, out - header);
+}
+
+static void capture_native_header(void)
+{
+    gchar header[CAPTURE_HEADER_SIZE], *out = header;
+
+    memcpy(out, CAPTURE_MAGIC, 8);
+    out += 8;
+    out = put_32(out, CAPTURE_VERSION);
+    out = put_32(out, 0);
+    out = put_64(out, capture_real_offset);
+
+    capture_write(header, out - header);
+}
+
+/* "file.pcapng" is written in pcapng, any other name in the GTKTerm
+   format */
+gboolean capture_start(const gchar *filename)
+{
+    if(capture_fd != -1)
+	capture_stop();
+
+    capture_format = g_str_has_suffix(filename, ".pcapng") ? CAPTURE_PCAPNG : CAPTURE_NATIVE;
+    capture_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(capture_fd == -1)
+    {
+	i18n_fprintf(stderr, _("Cannot open file %s: %s\n"), filename, strerror(errno));
+	return FALSE;
+    }
+
+    if(capture_fill == NULL)
+    {
+	capture_fill = g_malloc(CAPTURE_BUFFER_SIZE);
+	capture_free = g_malloc(CAPTURE_BUFFER_SIZE);
+    }
+    capture_fill_used = 0;
+    capture_pending = NULL;
+    capture_dropped = 0;
+    capture_errno = 0;
+    capture_quit = FALSE;
+    capture_real_offset = g_get_real_time() - g_get_monotonic_time();
+
+    if(capture_format == CAPTURE_PCAPNG)
+	capture_pcapng_header();
+    else
+	capture_native_header();
+
+    if(capture_errno != 0 || pthread_create(&capture_thread, NULL, capture_main, NULL) != 0)
+    {
+	i18n_fprintf(stderr, _("Cannot start the capture to %s: %s\n"), filename,
+		     strerror(capture_errno != 0 ? capture_errno : errno));
+	close(capture_fd);
+	capture_fd = -1;
+	return FALSE;
+    }
+    g_atomic_int_set(&capture_on, 1);
+
+    return TRUE;
+}
+
+void capture_stop(void)
+{
+    if(capture_fd == -1)
+	return;
+
+    g_atomic_int_set(&capture_on, 0);
+    pthread_mutex_lock(&capture_lock);
+    capture_quit = TRUE;
+    pthread_cond_signal(&capture_work);
+    pthread_mutex_unlock(&capture_lock);
+    pthread_join(capture_thread, NULL);
+
+    if(close(capture_fd) == -1 && capture_errno == 0)
+	capture_errno = errno;
+    capture_fd = -1;
+
+    if(capture_errno != 0)
+	i18n_fprintf(stderr, _("Capture failed: %s\n"), strerror(capture_errno));
+    if(capture_dropped != 0)
+	i18n_fprintf(stderr, _("Capture: %llu bytes dropped, the disk is too slow\n"),
+		     (unsigned long long)capture_dropped);
+}
+
+gboolean capture_running(void)
+{
+    return g_atomic_int_get(&capture_on);
+}
+
+/* From any thread */
+void capture_record(gint direction, gint lines, const gchar *data, gsize size)
+{
+    gint64 now;
+    gsize length, padded, need;
+    gchar *out;
+
+    if(!g_atomic_int_get(&capture_on))
+	return;
+
+    now = g_get_monotonic_time();
+
+    pthread_mutex_lock(&capture_lock);
+    while(size > 0)
+    {
+	length = MIN(size, CAPTURE_MAX_PAYLOAD);
+	padded = (length + 3) & ~(gsize)3;
+	need = (capture_format == CAPTURE_PCAPNG) ? 44 + padded : CAPTURE_RECORD_SIZE + length;
+
+	if(capture_fill_used + need > CAPTURE_BUFFER_SIZE)
+	{
+	    if(capture_free == NULL)
+	    {
+		capture_dropped += size;
+		break;
+	    }
+	    capture_hand_over();
+	}
+
+	out = capture_fill + capture_fill_used;
+	if(capture_format == CAPTURE_PCAPNG)
+	{
+	    /* enhanced packet block, the direction in epb_flags */
+	    out = put_32(out, 6);
+	    out = put_32(out, need);
+	    out = put_32(out, 0);
+	    out = put_32(out, (guint64)(now + capture_real_offset) >> 32);
+	    out = put_32(out, (guint32)(now + capture_real_offset));
+	    out = put_32(out, length);
+	    out = put_32(out, length);
+	    memcpy(out, data, length);
+	    memset(out + length, 0, padded - length);
+	    out += padded;
+	    out = put_16(out, 2);
+	    out = put_16(out, 4);
+	    out = put_32(out, direction == CAPTURE_RX ? 1 : 2);
+	    out = put_32(out, 0);
+	    out = put_32(out, need);
+	}
+	else
+	{
+	    out = put_64(out, now);
+	    *out++ = direction;
+	    *out++ = 0;
+	    out = put_16(out, lines);
+	    out = put_32(out, length);
+	    memcpy(out, data, length);
+	}
+	capture_fill_used += need;
+	data += length;
+	size -= length;
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
@@ -0,0 +1,49 @@
+/***********************************************************************/
+/* capture.h                                                           */
+/* ---------                                                           */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Capture of the data received and sent, with their              */
+/*      time, direction and modem lines : GTKTerm binary               */
+/*      format or pcapng                                               */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <glib.h>
+
+/* GTKTerm capture file, all the fields little endian :
+     header : "GTKTCAP1", guint32 version, guint32 0,
+              gint64 wall clock time (us since the epoch) at
+              monotonic time 0 of the records,
+     then records : gint64 monotonic time (us), guint8 direction,
+              guint8 0, guint16 modem lines (TIOCM_* bits),
+              guint32 payload size, payload */
+#define CAPTURE_MAGIC "GTKTCAP1"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 24
+#define CAPTURE_RECORD_SIZE 16
+
+#define CAPTURE_RX 0
+#define CAPTURE_TX 1
+
+#define CAPTURE_NATIVE 0
+#define CAPTURE_PCAPNG 1          /* chosen by the ".pcapng" file name */
+
+#define CAPTURE_BUFFER_SIZE (1024 * 1024)
+#define CAPTURE_FLUSH_MS 200      /* max delay before the data is written */
+#define CAPTURE_LINKTYPE 147      /* LINKTYPE_USER0 */
+
+gboolean capture_start(const gchar *);
+void capture_stop(void);
+gboolean capture_running(void);
+void capture_record(gint direction, gint lines, const gchar *data, gsize size);
+
+#endif
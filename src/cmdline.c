@@ -24,13 +24,54 @@
 
 #include "term_config.h"
 #include "fichier.h"
+#include "serie.h"
 #include "auto_config.h"
 #include "i18n.h"
+#include "detonator.h"
+#include "logging.h"
+#include "capture.h"
+#include "replay.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
 
 extern struct configuration_port config;
+extern display_config_t term_conf;
+
+#define SHORT_OPTIONS "s:a:t:b:f:p:w:d:r:hec:x:y:TB:k:R:D:CNL:o:F:G:K:P:S:X"
+
+static struct option long_options[] = {
+  {"speed", 1, 0, 's'},
+  {"parity", 1, 0, 'a'},
+  {"stopbits", 1, 0, 't'},
+  {"bits", 1, 0, 'b'},
+  {"file", 1, 0, 'f'},
+  {"port", 1, 0, 'p'},
+  {"flow", 1, 0, 'w'},
+  {"delay", 1, 0, 'd'},
+  {"char", 1, 0, 'r'},
+  {"help", 0, 0, 'h'},
+  {"echo", 0, 0, 'e'},
+  {"rts_time_before", 1, 0, 'x'},
+  {"rts_time_after", 1, 0, 'y'},
+  {"config", 1, 0, 'c'},
+  {"thread", 0, 0, 'T'},
+  {"buffer", 1, 0, 'B'},
+  {"chunk", 1, 0, 'k'},
+  {"detonate", 1, 0, 'D'},
+  {"counters", 0, 0, 'C'},
+  {"trace", 0, 0, 'X'},
+  {"render-limit", 1, 0, 'R'},
+  {"headless", 0, 0, 'N'},
+  {"log", 1, 0, 'L'},
+  {"log-format", 1, 0, 'o'},
+  {"log-flush", 1, 0, 'F'},
+  {"log-rotate", 1, 0, 'G'},
+  {"capture", 1, 0, 'K'},
+  {"replay", 1, 0, 'P'},
+  {"replay-speed", 1, 0, 'S'},
+  {0, 0, 0, 0}
+};
 
 void display_help(void)
 {
@@ -53,37 +94,67 @@ void display_help(void)
   i18n_printf(_("--rts_time_before <ms> or -x : for rs485, time in ms before transmit with rts on\n"));
   i18n_printf(_("--rts_time_after <ms> or -y : for rs485, time in ms after transmit with rts on\n"));
   i18n_printf(_("--echo or -e : switch on local echo\n"));
+  i18n_printf(_("--thread or -T : read the port from a dedicated thread\n"));
+  i18n_printf(_("--buffer <MB> or -B : size of the history of received data (default 16)\n"));
+  i18n_printf(_("--chunk <KB> or -k : size of the chunks of a file transfer (default 64)\n"));
+  i18n_printf(_("--render-limit <KB> or -R : at most KB given to the terminal per frame,\n"));
+  i18n_printf(_("\tthe rest is skipped on screen only (default 0 : no limit)\n"));
+  i18n_printf(_("--headless or -N : no window, received data to stdout, stdin to the port\n"));
+  i18n_printf(_("\t~. on stdin quits, ~<shortcut> sends a macro, ~~ sends a ~\n"));
+  i18n_printf(_("--log <filename> or -L : log the received data to the file\n"));
+  i18n_printf(_("--capture <filename> or -K : capture the data received and sent, with\n"));
+  i18n_printf(_("\ttheir time, in the GTKTerm format, or in pcapng if the name ends with .pcapng\n"));
+  i18n_printf(_("--replay <filename> or -P : feed a capture, or a raw file at the line rate,\n"));
+  i18n_printf(_("\tto the terminal and the log as if it was received\n"));
+  i18n_printf(_("--replay-speed <factor | max> or -S : replay timing (default 1 : original),\n"));
+  i18n_printf(_("\tmax replays as fast as possible and reports the time taken\n"));
+  i18n_printf(_("--log-format <raw | hex | timestamp> or -o : format of the log (default raw)\n"));
+  i18n_printf(_("--log-rotate <options> or -G : rotation of the log file, options separated\n"));
+  i18n_printf(_("\tby commas : size=<MB>,age=<minutes>,keep=<N> (default 10),gzip\n"));
+  i18n_printf(_("--log-flush <bytes=<N> | ms=<N> | line> or -F : when the log buffer\n"));
+  i18n_printf(_("\tis written to the disk (default ms=100)\n"));
+  i18n_printf(_("--counters or -C : print the port rates and UART error counters every second\n"));
+  i18n_printf(_("--trace or -X : print the data received and sent to stdout (slow)\n"));
+  i18n_printf(_("--detonate <options> or -D : run the detonator load generator without window\n"));
+  i18n_printf(_("\toptions : size=<bytes>,rate=<bytes/s>,pps=<packets/s>,duration=<s>,\n"));
+  i18n_printf(_("\t          pattern=<counter | readable | prbs7 | prbs15 | prbs23 | prbs31>,\n"));
+  i18n_printf(_("\t          seq,check\n"));
   i18n_printf("\n");
 }
 
+/* The modes without a window have to be known before the window is
+   created, that is before the command line is read */
+gboolean headless_command_line(int argc, char **argv)
+{
+  int c;
+  gboolean headless = FALSE;
+
+  /* getopt decides, as in read_command_line(), but silently. The
+     leading '-' keeps argv in order for gtk_init() */
+  opterr = 0;
+  while((c = getopt_long(argc, argv, "-" SHORT_OPTIONS, long_options, NULL)) != -1)
+    {
+      if(c == 'D' || c == 'N')
+	headless = TRUE;
+    }
+  opterr = 1;
+  /* read_command_line() starts over */
+  optind = 0;
+
+  return headless;
+}
+
 int read_command_line(int argc, char **argv)
 {
   int c;
   int option_index = 0;
-
-  static struct option long_options[] = {
-    {"speed", 1, 0, 's'},
-    {"parity", 1, 0, 'a'},
-    {"stopbits", 1, 0, 't'},
-    {"bits", 1, 0, 'b'},
-    {"file", 1, 0, 'f'},
-    {"port", 1, 0, 'p'},
-    {"flow", 1, 0, 'w'},
-    {"delay", 1, 0, 'd'},
-    {"char", 1, 0, 'r'},
-    {"help", 0, 0, 'h'},
-    {"echo", 0, 0, 'e'},
-    {"rts_time_before", 1, 0, 'x'},
-    {"rts_time_after", 1, 0, 'y'},
-    {"config", 1, 0, 'c'},
-    {0, 0, 0, 0}
-  };
+  gchar *log_file = NULL;
 
   /* need a working configuration file ! */
   Check_configuration_file();
 
   while(1) {
-    c = getopt_long (argc, argv, "s:a:t:b:f:p:w:d:r:hec:x:y:", long_options, &option_index);
+    c = getopt_long (argc, argv, SHORT_OPTIONS, long_options, &option_index);
 
     if(c == -1)
       break;
@@ -142,6 +213,73 @@ int read_command_line(int argc, char **argv)
 	config.echo = TRUE;
 	break;
 
+      case 'T':
+	config.reader_thread = TRUE;
+	break;
+
+      case 'B':
+	config.buffer_size = atoi(optarg);
+	break;
+
+      case 'k':
+	config.file_chunk = atoi(optarg);
+	break;
+
+      case 'R':
+	term_conf.render_limit = atoi(optarg);
+	break;
+
+      case 'D':
+	if(detonator_parse(optarg) == FALSE)
+	  return -1;
+	break;
+
+      case 'C':
+	print_counters = TRUE;
+	break;
+
+      case 'X':
+	trace_on_stdout = TRUE;
+	break;
+
+      case 'N':
+	/* already known by headless_command_line() */
+	break;
+
+      case 'L':
+	/* started once --log-format is known */
+	log_file = optarg;
+	break;
+
+      case 'o':
+	if(logging_set_format(optarg) == FALSE)
+	  return -1;
+	break;
+
+      case 'F':
+	if(logging_set_flush(optarg) == FALSE)
+	  return -1;
+	break;
+
+      case 'G':
+	if(logging_set_rotation(optarg) == FALSE)
+	  return -1;
+	break;
+
+      case 'K':
+	if(capture_start(optarg) == FALSE)
+	  return -1;
+	break;
+
+      case 'P':
+	replay_set_file(optarg);
+	break;
+
+      case 'S':
+	if(replay_set_speed(optarg) == FALSE)
+	  return -1;
+	break;
+
       case 'x':
 	config.rs485_rts_time_before_transmit = atoi(optarg);
 	break;
@@ -160,6 +298,10 @@ int read_command_line(int argc, char **argv)
     }
   }
   Verify_configuration();
+
+  if(log_file != NULL && logging_start_file(log_file) == FALSE)
+    return -1;
+
   return 0;
 }
 
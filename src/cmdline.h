@@ -16,3 +16,4 @@
 /***********************************************************************/
 
 int read_command_line(int, char **);
+gboolean headless_command_line(int, char **);
@@ -0,0 +1,201 @@
+/***********************************************************************/
+/* crlf.c                                                              */
+/* ------                                                              */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      CR / LF normalization for the CR LF auto mode.                 */
+/*      A lone CR or LF becomes CR LF ; the SSE2 / AVX2 kernels        */
+/*      look for the next CR or LF 16 / 32 bytes at a time and         */
+/*      copy the runs in between in bulk                               */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+#include <string.h>
+
+#include "crlf.h"
+
+#ifdef HAVE_CRLF_SIMD
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+/* Handles one CR or LF, exactly as put_chars() always did */
+static inline gchar *crlf_special(gchar c, gchar *out, gint *cr_received)
+{
+    if(c == '\r')
+    {
+	/* If the previous character was a CR too, insert a newline */
+	if(*cr_received)
+	    *out++ = '\n';
+	*cr_received = 1;
+    }
+    else
+    {
+	/* If we get a newline without a CR first, insert a CR */
+	if(!*cr_received)
+	    *out++ = '\r';
+	*cr_received = 0;
+    }
+    *out++ = c;
+
+    return out;
+}
+
+/* Copies a run without CR nor LF : if the previous character was a CR
+   insert a newline first */
+static inline gchar *crlf_run(const gchar *in, gsize length, gchar *out, gint *cr_received)
+{
+    if(length == 0)
+	return out;
+
+    if(*cr_received)
+    {
+	*out++ = '\n';
+	*cr_received = 0;
+    }
+    memcpy(out, in, length);
+
+    return out + length;
+}
+
+gsize crlf_convert_scalar(const gchar *in, gsize size, gchar *out, gint *cr_received)
+{
+    gchar *start = out;
+    gsize i;
+
+    for(i = 0; i < size; i++)
+    {
+	if(in[i] == '\r' || in[i] == '\n')
+	    out = crlf_special(in[i], out, cr_received);
+	else
+	{
+	    /* If we receive a normal char, and the previous one was a
+	       CR insert a newline */
+	    if(*cr_received)
+	    {
+		*out++ = '\n';
+		*cr_received = 0;
+	    }
+	    *out++ = in[i];
+	}
+    }
+
+    return out - start;
+}
+
+#ifdef HAVE_CRLF_SIMD
+
+__attribute__((target("sse2")))
+gsize crlf_convert_sse2(const gchar *in, gsize size, gchar *out, gint *cr_received)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    gchar *start = out;
+    gsize i = 0, run = 0;
+    guint mask;
+
+    while(i + 16 <= size)
+    {
+	__m128i block = _mm_loadu_si128((const __m128i *)(in + i));
+	mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, cr),
+					      _mm_cmpeq_epi8(block, lf)));
+	if(mask == 0)
+	{
+	    i += 16;
+	    continue;
+	}
+	while(mask != 0)
+	{
+	    gsize pos = i + __builtin_ctz(mask);
+
+	    out = crlf_run(in + run, pos - run, out, cr_received);
+	    out = crlf_special(in[pos], out, cr_received);
+	    run = pos + 1;
+	    mask &= mask - 1;
+	}
+	i += 16;
+    }
+
+    out = crlf_run(in + run, i - run, out, cr_received);
+
+    return (out - start) + crlf_convert_scalar(in + i, size - i, out, cr_received);
+}
+
+__attribute__((target("avx2")))
+gsize crlf_convert_avx2(const gchar *in, gsize size, gchar *out, gint *cr_received)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    gchar *start = out;
+    gsize i = 0, run = 0;
+    guint mask;
+
+    while(i + 32 <= size)
+    {
+	__m256i block = _mm256_loadu_si256((const __m256i *)(in + i));
+	mask = (guint)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, cr),
+							   _mm256_cmpeq_epi8(block, lf)));
+	if(mask == 0)
+	{
+	    i += 32;
+	    continue;
+	}
+	while(mask != 0)
+	{
+	    gsize pos = i + __builtin_ctz(mask);
+
+	    out = crlf_run(in + run, pos - run, out, cr_received);
+	    out = crlf_special(in[pos], out, cr_received);
+	    run = pos + 1;
+	    mask &= mask - 1;
+	}
+	i += 32;
+    }
+
+    out = crlf_run(in + run, i - run, out, cr_received);
+
+    return (out - start) + crlf_convert_scalar(in + i, size - i, out, cr_received);
+}
+
+#endif
+
+/* Chooses the best kernel for this CPU, once */
+crlf_func_t crlf_get_kernel(const gchar **name)
+{
+    static crlf_func_t kernel = NULL;
+    static const gchar *kernel_name;
+
+    if(kernel == NULL)
+    {
+	kernel = crlf_convert_scalar;
+	kernel_name = "scalar";
+#ifdef HAVE_CRLF_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+	    kernel = crlf_convert_avx2;
+	    kernel_name = "avx2";
+	}
+	else if(__builtin_cpu_supports("sse2"))
+	{
+	    kernel = crlf_convert_sse2;
+	    kernel_name = "sse2";
+	}
+#endif
+    }
+
+    if(name != NULL)
+	*name = kernel_name;
+
+    return kernel;
+}
+
+gsize crlf_convert(const gchar *in, gsize size, gchar *out, gint *cr_received)
+{
+    return crlf_get_kernel(NULL)(in, size, out, cr_received);
+}
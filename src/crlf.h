@@ -0,0 +1,35 @@
+/***********************************************************************/
+/* crlf.h                                                              */
+/* ------                                                              */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      CR / LF normalization for the CR LF auto mode                  */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef CRLF_H_
+#define CRLF_H_
+
+#include <glib.h>
+
+/* Converts 'size' bytes from 'in' to 'out', which must hold 2 * size bytes,
+   and returns the number of bytes written. *cr_received carries the state
+   from one chunk to the next. */
+typedef gsize (*crlf_func_t)(const gchar *, gsize, gchar *, gint *);
+
+gsize crlf_convert(const gchar *, gsize, gchar *, gint *);
+gsize crlf_convert_scalar(const gchar *, gsize, gchar *, gint *);
+crlf_func_t crlf_get_kernel(const gchar **);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_CRLF_SIMD 1
+gsize crlf_convert_sse2(const gchar *, gsize, gchar *, gint *);
+gsize crlf_convert_avx2(const gchar *, gsize, gchar *, gint *);
+#endif
+
+#endif
@@ -0,0 +1,582 @@
+/***********************************************************************/
+/* detonator.c                                                         */
+/* -----------                                                         */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Load generator : sends packets to the port at a given          */
+/*      rate and reports the achieved rate and write() latency.        */
+/*      Runs from the Debugging menu or from the command line          */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "term_config.h"
+#include "serie.h"
+#include "widgets.h"
+#include "detonator.h"
+#include "prbs.h"
+#include "i18n.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+static detonator_config_t settings =
+{
+    DETONATOR_DEFAULT_SIZE, 0, 0, DETONATOR_READABLE, 0, FALSE, FALSE
+};
+
+/* The generator thread only writes these, the main loop reads them */
+static pthread_t detonator_thread;
+static gboolean detonator_running = FALSE;
+static volatile gint detonator_quit = 0;
+static volatile gint detonator_finished = 0;
+static guint64 sent_bytes;
+static guint sent_packets;
+static guint queue_full;
+static gint64 start_time;
+static gint64 end_time;
+static prbs_t prbs;
+
+/* The checker is fed by the main loop, which also reads it */
+static prbs_check_t checker;
+static gboolean checking = FALSE;
+static gint64 check_report_time;
+
+static gboolean cli_requested = FALSE;
+static GMainLoop *cli_loop = NULL;
+static GtkWidget *detonator_window = NULL;
+static GtkWidget *detonator_label;
+static GtkWidget *detonator_widgets[7];
+
+extern struct configuration_port config;
+
+static const gchar *pattern_name(gint pattern)
+{
+    switch(pattern)
+    {
+	case DETONATOR_COUNTER:
+	    return _("counter");
+	case DETONATOR_PRBS7:
+	    return _("PRBS-7");
+	case DETONATOR_PRBS15:
+	    return _("PRBS-15");
+	case DETONATOR_PRBS23:
+	    return _("PRBS-23");
+	case DETONATOR_PRBS31:
+	    return _("PRBS-31");
+	default:
+	    return _("readable");
+    }
+}
+
+/* 0 if the pattern is not a PRBS */
+static gint pattern_order(gint pattern)
+{
+    static const gint orders[] = {0, 0, 7, 15, 23, 31};
+
+    return orders[pattern];
+}
+
+/* Options of the command line : size=, rate= (bytes/s), pps=,
+   pattern=counter|readable|prbs7|prbs15|prbs23|prbs31 (prbs is
+   PRBS-15), duration= (s), seq and check, separated by commas */
+gboolean detonator_parse(const gchar *options)
+{
+    gchar **tokens, *value;
+    gint i;
+    gboolean valid = TRUE;
+
+    tokens = g_strsplit(options, ",", -1);
+    for(i = 0; tokens[i] != NULL && valid == TRUE; i++)
+    {
+	value = strchr(tokens[i], '=');
+	if(value != NULL)
+	    *value++ = 0;
+
+	if(tokens[i][0] == 0)
+	    continue;
+	else if(!strcmp(tokens[i], "seq") && value == NULL)
+	    settings.sequence = TRUE;
+	else if(!strcmp(tokens[i], "check") && value == NULL)
+	    settings.check = TRUE;
+	else if(value == NULL)
+	    valid = FALSE;
+	else if(!strcmp(tokens[i], "size"))
+	    settings.packet_size = atoi(value);
+	else if(!strcmp(tokens[i], "rate"))
+	    settings.bytes_per_second = atoi(value);
+	else if(!strcmp(tokens[i], "pps"))
+	    settings.packets_per_second = atoi(value);
+	else if(!strcmp(tokens[i], "duration"))
+	    settings.duration = atoi(value);
+	else if(!strcmp(tokens[i], "pattern") && !strcmp(value, "counter"))
+	    settings.pattern = DETONATOR_COUNTER;
+	else if(!strcmp(tokens[i], "pattern") && (!strcmp(value, "prbs") || !strcmp(value, "prbs15")))
+	    settings.pattern = DETONATOR_PRBS15;
+	else if(!strcmp(tokens[i], "pattern") && !strcmp(value, "prbs7"))
+	    settings.pattern = DETONATOR_PRBS7;
+	else if(!strcmp(tokens[i], "pattern") && !strcmp(value, "prbs23"))
+	    settings.pattern = DETONATOR_PRBS23;
+	else if(!strcmp(tokens[i], "pattern") && !strcmp(value, "prbs31"))
+	    settings.pattern = DETONATOR_PRBS31;
+	else if(!strcmp(tokens[i], "pattern") && !strcmp(value, "readable"))
+	    settings.pattern = DETONATOR_READABLE;
+	else
+	    valid = FALSE;
+
+	if(valid == FALSE)
+	    i18n_fprintf(stderr, _("Invalid detonator option: %s\n"), tokens[i]);
+    }
+    g_strfreev(tokens);
+    cli_requested = TRUE;
+
+    if(valid == TRUE &&
+       (settings.packet_size < 1 || settings.packet_size > DETONATOR_MAX_SIZE ||
+	settings.bytes_per_second < 0 || settings.packets_per_second < 0 || settings.duration < 0))
+    {
+	i18n_fprintf(stderr, _("Invalid detonator settings (packet size from 1 to %d bytes)\n"), DETONATOR_MAX_SIZE);
+	valid = FALSE;
+    }
+    else if(valid == TRUE && settings.check == TRUE && pattern_order(settings.pattern) == 0)
+    {
+	i18n_fprintf(stderr, _("The bit error rate test needs a PRBS pattern\n"));
+	valid = FALSE;
+    }
+    else if(valid == TRUE && settings.check == TRUE && settings.sequence == TRUE)
+    {
+	/* the sequence numbers overwrite the PRBS : bit errors in every packet */
+	i18n_fprintf(stderr, _("The bit error rate test cannot be used with sequence numbers\n"));
+	valid = FALSE;
+    }
+
+    return valid;
+}
+
+/* The sequence number replaces the first bytes of the pattern : 8 hex
+   digits in readable mode, 4 bytes big endian otherwise */
+static void detonator_fill(guint8 *packet, guint32 number)
+{
+    gint i, size;
+    gchar sequence[9];
+
+    size = settings.packet_size;
+    switch(settings.pattern)
+    {
+	case DETONATOR_COUNTER:
+	    for(i = 0; i < size; i++)
+		packet[i] = i;
+	    break;
+
+	case DETONATOR_READABLE:
+	    for(i = 0; i < size; i++)
+		packet[i] = 48 + (i % 42);
+	    break;
+
+	default:
+	    prbs_generate(&prbs, packet, size);
+	    break;
+    }
+
+    if(settings.sequence == FALSE)
+	return;
+
+    if(settings.pattern == DETONATOR_READABLE)
+    {
+	g_snprintf(sequence, sizeof(sequence), "%08X", number);
+	memcpy(packet, sequence, MIN(size, 8));
+    }
+    else
+    {
+	for(i = 0; i < 4 && i < size; i++)
+	    packet[i] = number >> (24 - 8 * i);
+    }
+}
+
+static void detonator_sleep_until(gint64 when)
+{
+    struct timespec ts;
+
+    ts.tv_sec = when / G_USEC_PER_SEC;
+    ts.tv_nsec = (when % G_USEC_PER_SEC) * 1000;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	;
+}
+
+static void *detonator_main(void *data)
+{
+    guint8 *packet;
+    gint offset, queued;
+    gint64 now, deadline;
+
+    packet = g_malloc(settings.packet_size);
+
+    while(!g_atomic_int_get(&detonator_quit))
+    {
+	now = g_get_monotonic_time();
+	if(settings.duration != 0 && now - start_time >= (gint64)settings.duration * G_USEC_PER_SEC)
+	    break;
+
+	/* each packet leaves at its date, so the rate does not drift */
+	deadline = start_time;
+	if(settings.bytes_per_second != 0)
+	    deadline = MAX(deadline, start_time + (gint64)(sent_bytes * G_USEC_PER_SEC / settings.bytes_per_second));
+	if(settings.packets_per_second != 0)
+	    deadline = MAX(deadline, start_time + (gint64)sent_packets * G_USEC_PER_SEC / settings.packets_per_second);
+	if(deadline > now)
+	{
+	    /* not too long, to see the end of the run */
+	    detonator_sleep_until(MIN(deadline, now + DETONATOR_WATCH * 1000));
+	    continue;
+	}
+
+	detonator_fill(packet, sent_packets);
+	for(offset = 0; offset < settings.packet_size; offset += queued)
+	{
+	    queued = Send_chars((char *)packet + offset, settings.packet_size - offset);
+	    if(offset + queued == settings.packet_size)
+		continue;
+	    if(serial_port_fd == -1 || g_atomic_int_get(&detonator_quit))
+	    {
+		offset += queued;
+		break;
+	    }
+	    queue_full++;
+	    poll(NULL, 0, DETONATOR_FULL_WAIT);
+	}
+	sent_bytes += offset;
+	if(offset != settings.packet_size)
+	    break;
+	sent_packets++;
+    }
+
+    end_time = g_get_monotonic_time();
+    g_free(packet);
+    g_atomic_int_set(&detonator_finished, 1);
+
+    return NULL;
+}
+
+static gboolean detonator_start(void)
+{
+    if(detonator_running == TRUE || serial_port_fd == -1)
+	return FALSE;
+
+    sent_bytes = 0;
+    sent_packets = 0;
+    queue_full = 0;
+    if(pattern_order(settings.pattern) != 0)
+	prbs_init(&prbs, pattern_order(settings.pattern));
+    if(settings.check == TRUE && pattern_order(settings.pattern) != 0)
+    {
+	prbs_check_init(&checker, pattern_order(settings.pattern));
+	set_rx_check(&checker);
+	checking = TRUE;
+    }
+    reset_tx_write_stats();
+    g_atomic_int_set(&detonator_quit, 0);
+    g_atomic_int_set(&detonator_finished, 0);
+    start_time = g_get_monotonic_time();
+
+    if(pthread_create(&detonator_thread, NULL, detonator_main, NULL) != 0)
+	return FALSE;
+    detonator_running = TRUE;
+
+    return TRUE;
+}
+
+static gchar *detonator_report(guint64 wire_bytes, gdouble elapsed)
+{
+    GString *text;
+    guint histogram[TX_WRITE_BUCKETS], short_writes, line_rate;
+    gchar *stats;
+    gint i;
+
+    get_tx_write_stats(histogram, &short_writes);
+    line_rate = get_line_rate();
+    elapsed = MAX(elapsed, 1e-6);
+
+    text = g_string_new(NULL);
+    g_string_append_printf(text, _("%u packets of %d bytes (%s pattern%s) in %.2f s\n"),
+			   sent_packets, settings.packet_size, pattern_name(settings.pattern),
+			   settings.sequence ? _(", sequence numbers") : "", elapsed);
+    g_string_append_printf(text, _("Achieved: %.0f bytes/s, %.1f packets/s"),
+			   wire_bytes / elapsed, sent_packets / elapsed);
+    if(settings.bytes_per_second != 0)
+	g_string_append_printf(text, _(", target %d bytes/s"), settings.bytes_per_second);
+    if(settings.packets_per_second != 0)
+	g_string_append_printf(text, _(", target %d packets/s"), settings.packets_per_second);
+    if(line_rate != 0)
+	g_string_append_printf(text, _(", %.0f%% of the line limit"), wire_bytes / elapsed * 100 / line_rate);
+    g_string_append_printf(text, _("\nTransmit queue full %u times, %u short write()s\n"),
+			   queue_full, short_writes);
+    g_string_append(text, _("write() latency:\n"));
+    for(i = 0; i < TX_WRITE_BUCKETS; i++)
+    {
+	if(histogram[i] != 0)
+	    g_string_append_printf(text, _("  < %u us : %u\n"), 1U << i, histogram[i]);
+    }
+
+    if(checking == TRUE)
+    {
+	stats = prbs_check_stats(&checker);
+	g_string_append_printf(text, "%s\n", stats);
+	g_free(stats);
+    }
+
+    return g_string_free(text, FALSE);
+}
+
+/* What is still queued is dropped : the rate is the one of the bytes
+   which really went out */
+static gchar *detonator_stop(void)
+{
+    guint64 pending;
+    gchar *report;
+
+    g_atomic_int_set(&detonator_quit, 1);
+    pthread_join(detonator_thread, NULL);
+    detonator_running = FALSE;
+
+    pending = get_tx_pending();
+    flush_tx();
+
+    report = detonator_report(sent_bytes - MIN(pending, sent_bytes),
+			      (gdouble)(end_time - start_time) / G_USEC_PER_SEC);
+    if(checking == TRUE)
+    {
+	set_rx_check(NULL);
+	checking = FALSE;
+    }
+
+    return report;
+}
+
+static void detonator_interrupt(int signal)
+{
+    g_atomic_int_set(&detonator_quit, 1);
+}
+
+static gboolean cli_watch(gpointer data)
+{
+    gchar *stats;
+    gint64 now;
+
+    now = g_get_monotonic_time();
+    if(checking == TRUE && now - check_report_time >= DETONATOR_CHECK_REPORT * 1000)
+    {
+	stats = prbs_check_stats(&checker);
+	i18n_fprintf(stderr, "%s\n", stats);
+	g_free(stats);
+	check_report_time = now;
+    }
+
+    if(!g_atomic_int_get(&detonator_finished))
+	return TRUE;
+
+    g_main_loop_quit(cli_loop);
+    return FALSE;
+}
+
+/* --detonate was on the command line */
+gboolean detonator_requested(void)
+{
+    return cli_requested;
+}
+
+/* Runs the detonator without any window, until the duration is over
+   or until interrupted */
+gint detonator_cli(void)
+{
+    struct sigaction action;
+    gchar *report;
+
+    if(serial_port_fd == -1)
+	return 1;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = detonator_interrupt;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if(detonator_start() == FALSE)
+    {
+	i18n_fprintf(stderr, _("Cannot start the detonator\n"));
+	return 1;
+    }
+    i18n_fprintf(stderr, _("Detonator running on %s, Ctrl-C to stop\n"), config.port);
+    check_report_time = g_get_monotonic_time();
+
+    cli_loop = g_main_loop_new(NULL, FALSE);
+    g_timeout_add(DETONATOR_WATCH, cli_watch, NULL);
+    g_main_loop_run(cli_loop);
+    g_main_loop_unref(cli_loop);
+    cli_loop = NULL;
+
+    report = detonator_stop();
+    i18n_printf("%s", report);
+    g_free(report);
+
+    return 0;
+}
+
+static gboolean gui_watch(gpointer data)
+{
+    gchar *text, *stats;
+
+    if(detonator_running == FALSE)
+	return FALSE;
+
+    if(!g_atomic_int_get(&detonator_finished))
+    {
+	stats = checking ? prbs_check_stats(&checker) : g_strdup("");
+	text = g_strdup_printf(_("Running : %u packets, %" G_GUINT64_FORMAT " bytes queued\n%s"),
+			       sent_packets, sent_bytes, stats);
+	g_free(stats);
+	gtk_label_set_text(GTK_LABEL(detonator_label), text);
+	g_free(text);
+	return TRUE;
+    }
+
+    text = detonator_stop();
+    gtk_label_set_text(GTK_LABEL(detonator_label), text);
+    g_free(text);
+
+    return FALSE;
+}
+
+static void start_clicked(GtkButton *button, gpointer data)
+{
+    if(detonator_running == TRUE)
+	return;
+
+    settings.packet_size = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(detonator_widgets[0]));
+    settings.bytes_per_second = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(detonator_widgets[1]));
+    settings.packets_per_second = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(detonator_widgets[2]));
+    settings.duration = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(detonator_widgets[3]));
+    settings.pattern = gtk_combo_box_get_active(GTK_COMBO_BOX(detonator_widgets[4]));
+    settings.sequence = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(detonator_widgets[5]));
+    settings.check = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(detonator_widgets[6]));
+
+    if(settings.check == TRUE && pattern_order(settings.pattern) == 0)
+    {
+	gtk_label_set_text(GTK_LABEL(detonator_label), _("The bit error rate test needs a PRBS pattern"));
+	return;
+    }
+    if(settings.check == TRUE && settings.sequence == TRUE)
+    {
+	gtk_label_set_text(GTK_LABEL(detonator_label), _("The bit error rate test cannot be used with sequence numbers"));
+	return;
+    }
+
+    if(detonator_start() == FALSE)
+    {
+	gtk_label_set_text(GTK_LABEL(detonator_label), _("Port not opened!"));
+	return;
+    }
+    gtk_label_set_text(GTK_LABEL(detonator_label), _("Running..."));
+    g_timeout_add(DETONATOR_WATCH, gui_watch, NULL);
+}
+
+static void stop_clicked(GtkButton *button, gpointer data)
+{
+    g_atomic_int_set(&detonator_quit, 1);
+}
+
+static void detonator_destroyed(GtkWidget *widget, gpointer data)
+{
+    if(detonator_running == TRUE)
+	g_free(detonator_stop());
+    detonator_window = NULL;
+}
+
+static GtkWidget *detonator_spin(GtkWidget *table, gint row, const gchar *text, gdouble min, gdouble max, gint value)
+{
+    GtkWidget *label, *spin;
+    GtkObject *adj;
+
+    label = gtk_label_new(text);
+    gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+    gtk_table_attach(GTK_TABLE(table), label, 0, 1, row, row + 1, GTK_FILL, 0, 10, 5);
+
+    adj = gtk_adjustment_new(value, min, max, 1.0, 100.0, 0.0);
+    spin = gtk_spin_button_new(GTK_ADJUSTMENT(adj), 0, 0);
+    gtk_spin_button_set_numeric(GTK_SPIN_BUTTON(spin), TRUE);
+    gtk_table_attach(GTK_TABLE(table), spin, 1, 2, row, row + 1, GTK_FILL | GTK_EXPAND, 0, 5, 5);
+
+    return spin;
+}
+
+void portDetonate(void)
+{
+    GtkWidget *Table, *Label, *Combo, *Check, *Bouton;
+    gint i;
+
+    if(detonator_window != NULL)
+    {
+	gtk_window_present(GTK_WINDOW(detonator_window));
+	return;
+    }
+
+    detonator_window = gtk_dialog_new();
+    gtk_window_set_title(GTK_WINDOW(detonator_window), _("Detonator"));
+    g_signal_connect(GTK_OBJECT(detonator_window), "destroy", G_CALLBACK(detonator_destroyed), NULL);
+
+    Table = gtk_table_new(8, 2, FALSE);
+    gtk_box_pack_start(GTK_BOX(GTK_DIALOG(detonator_window)->vbox), Table, FALSE, FALSE, 5);
+
+    detonator_widgets[0] = detonator_spin(Table, 0, _("Packet size (bytes):"), 1, DETONATOR_MAX_SIZE, settings.packet_size);
+    detonator_widgets[1] = detonator_spin(Table, 1, _("Bytes per second (0 : no limit):"), 0, G_MAXINT, settings.bytes_per_second);
+    detonator_widgets[2] = detonator_spin(Table, 2, _("Packets per second (0 : no limit):"), 0, G_MAXINT, settings.packets_per_second);
+    detonator_widgets[3] = detonator_spin(Table, 3, _("Duration in s (0 : until stopped):"), 0, 86400, settings.duration);
+
+    Label = gtk_label_new(_("Pattern:"));
+    gtk_misc_set_alignment(GTK_MISC(Label), 0, 0.5);
+    gtk_table_attach(GTK_TABLE(Table), Label, 0, 1, 4, 5, GTK_FILL, 0, 10, 5);
+    Combo = gtk_combo_box_new_text();
+    for(i = DETONATOR_COUNTER; i <= DETONATOR_PRBS31; i++)
+	gtk_combo_box_append_text(GTK_COMBO_BOX(Combo), pattern_name(i));
+    gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), settings.pattern);
+    gtk_table_attach(GTK_TABLE(Table), Combo, 1, 2, 4, 5, GTK_FILL | GTK_EXPAND, 0, 5, 5);
+    detonator_widgets[4] = Combo;
+
+    Check = gtk_check_button_new_with_label(_("Sequence numbers"));
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(Check), settings.sequence);
+    gtk_table_attach(GTK_TABLE(Table), Check, 0, 2, 5, 6, GTK_FILL, 0, 10, 5);
+    detonator_widgets[5] = Check;
+
+    Check = gtk_check_button_new_with_label(_("Check the received PRBS (loopback bit error rate test)"));
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(Check), settings.check);
+    gtk_table_attach(GTK_TABLE(Table), Check, 0, 2, 6, 7, GTK_FILL, 0, 10, 5);
+    detonator_widgets[6] = Check;
+
+    detonator_label = gtk_label_new("");
+    gtk_misc_set_alignment(GTK_MISC(detonator_label), 0, 0);
+    gtk_label_set_selectable(GTK_LABEL(detonator_label), TRUE);
+    gtk_table_attach(GTK_TABLE(Table), detonator_label, 0, 2, 7, 8, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 10, 5);
+
+    Bouton = gtk_button_new_from_stock(GTK_STOCK_EXECUTE);
+    g_signal_connect(GTK_OBJECT(Bouton), "clicked", G_CALLBACK(start_clicked), NULL);
+    gtk_box_pack_start(GTK_BOX(GTK_DIALOG(detonator_window)->action_area), Bouton, FALSE, TRUE, 0);
+    Bouton = gtk_button_new_from_stock(GTK_STOCK_STOP);
+    g_signal_connect(GTK_OBJECT(Bouton), "clicked", G_CALLBACK(stop_clicked), NULL);
+    gtk_box_pack_start(GTK_BOX(GTK_DIALOG(detonator_window)->action_area), Bouton, FALSE, TRUE, 0);
+    Bouton = gtk_button_new_from_stock(GTK_STOCK_CLOSE);
+    g_signal_connect_swapped(GTK_OBJECT(Bouton), "clicked", G_CALLBACK(gtk_widget_destroy), GTK_OBJECT(detonator_window));
+    gtk_box_pack_start(GTK_BOX(GTK_DIALOG(detonator_window)->action_area), Bouton, FALSE, TRUE, 0);
+
+    gtk_widget_show_all(detonator_window);
+}
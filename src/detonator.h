@@ -1,89 +1,50 @@
+/***********************************************************************/
+/* detonator.h                                                         */
+/* -----------                                                         */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Load generator : sends packets to the port at a given          */
+/*      rate and reports the achieved rate and write() latency         */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
 #ifndef DETONATOR_H_
 #define DETONATOR_H_
 
-#include "serie.h"
-#include "widgets.h"
-#include <stdint.h>
-#include <pthread.h>
-
-#define DETONATOR_READABLE_ONLY 1
-#define testPacketSize 4096
+#include <glib.h>
 
-static uint8_t testData[testPacketSize];
-static uint8_t testDataInitialized = 0;
-static uint8_t detonationEnd = 0;
-static uint32_t packetNumber= 0;
+#define DETONATOR_COUNTER 0       /* 0x00, 0x01, ... in each packet */
+#define DETONATOR_READABLE 1      /* '0' to 'Y' in each packet */
+#define DETONATOR_PRBS7 2         /* PRBS running across the packets */
+#define DETONATOR_PRBS15 3
+#define DETONATOR_PRBS23 4
+#define DETONATOR_PRBS31 5
 
-#if DETONATOR_READABLE_ONLY == 0
-void detonateInitArray()
-{
-	for (size_t i=0;i<testPacketSize;i++)
-	{
-		testData[i] = i%256;
-	}
-    testDataInitialized = 1;
-}
-#else
-void detonateInitArray()
-{
-	for (size_t i=0;i<testPacketSize;i++)
-	{
-		testData[i] = 48+(i%42);
-	}
-    testDataInitialized = 1;
-}
-#endif
+#define DETONATOR_DEFAULT_SIZE 4096
+#define DETONATOR_MAX_SIZE (64 * 1024)
+#define DETONATOR_FULL_WAIT 1     /* in ms (transmit queue full) */
+#define DETONATOR_WATCH 100       /* in ms (end of the run) */
+#define DETONATOR_CHECK_REPORT 1000 /* in ms (checker on the command line) */
 
-static void disableDetonationTest (GtkButton* button, gpointer func_data)
+typedef struct
 {
-	detonationEnd = 1;
-}
-
-static void * bombardSerialPort(void *data)
-{
-	detonationEnd = 0;
-	while (!detonationEnd)
-	{
-		if (Send_chars(testData, testPacketSize) != 0)
-		{
-			printf("%d test packet sent.\n",packetNumber++);
-		}
-		else
-		{
-			printf("Port not opened!\n");
-		}
-        usleep(100);
-	}
-    return NULL;
-}
-
-void portDetonate(void)
-{
-	GtkWidget *Dialogue, *btn;
-    pthread_t serialWriteThread;
-    pthread_attr_t attr;
-
-    packetNumber = 0;
-	if (!testDataInitialized)
-	{
-		detonateInitArray();
-	}
-
-    pthread_attr_init(&attr);
-    if(pthread_create(&serialWriteThread, &attr, &bombardSerialPort, NULL)) {
-        printf("Error creating thread\n");
-    }
-	Dialogue = gtk_dialog_new();
-	gtk_window_set_title(GTK_WINDOW(Dialogue), "Detonator - click to end.");
-	btn = gtk_button_new_from_stock(GTK_STOCK_OK);
-	gtk_signal_connect_object(GTK_OBJECT(btn), "clicked", GTK_SIGNAL_FUNC(disableDetonationTest), 0);
-	gtk_signal_connect_object(GTK_OBJECT(btn), "clicked", (GtkSignalFunc) gtk_widget_destroy, GTK_OBJECT(Dialogue));
-	gtk_signal_connect(GTK_OBJECT(Dialogue), "destroy", (GtkSignalFunc) gtk_widget_destroy, NULL);
-	gtk_signal_connect(GTK_OBJECT(Dialogue), "delete_event", (GtkSignalFunc) gtk_widget_destroy, NULL);
-	gtk_box_pack_start(GTK_BOX(GTK_DIALOG(Dialogue)->action_area), btn, TRUE, TRUE, 0);
-	gtk_window_set_modal(Dialogue, 0);
-	//gtk_window_set_transient_for(Dialogue,*this);
-	gtk_widget_show_all(Dialogue);
-}
+    gint packet_size;             /* in bytes */
+    gint bytes_per_second;        /* 0 : no limit */
+    gint packets_per_second;      /* 0 : no limit */
+    gint pattern;
+    gint duration;                /* in s, 0 : until stopped */
+    gboolean sequence;            /* packet number at the start of each packet */
+    gboolean check;               /* bit error rate test of the received PRBS */
+} detonator_config_t;
+
+gboolean detonator_parse(const gchar *);
+gint detonator_cli(void);
+gboolean detonator_requested(void);
+void portDetonate(void);
 
 #endif
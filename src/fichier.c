@@ -27,6 +27,10 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#if defined (__linux__)
+#  include <sys/timerfd.h>      /* For line pacing */
+#endif
 #include <errno.h>
 #include <string.h>
 #include <glib.h>
@@ -35,21 +39,34 @@
 #include "widgets.h"
 #include "serie.h"
 #include "buffer.h"
+#include "fichier.h"
+#include "hexparse.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
 
 /* Global variables */
-gint nb_car;
-gint car_written;
-gint current_buffer_position;
-gint bytes_read;
+gsize nb_car;
+gsize car_written;
+gchar *file_map = NULL;
+gboolean file_allocated = FALSE;
+gint64 transfer_start;
+gint64 progress_time;
+guint end_handler = 0;
+GArray *line_index = NULL;
+GArray *line_delays = NULL;
+guint current_line;
+gint64 line_drained;
+gboolean line_draining = FALSE;
+gint pacing_fd = -1;
+guint pacing_handler = 0;
+guint pacing_timeout_handler = 0;
 GtkAdjustment *adj;
 GtkWidget *ProgressBar;
-gint Fichier;
+gint Fichier = -1;
 guint callback_handler;
 gchar *fic_defaut = NULL;
-GtkWidget *Window;
+GtkWidget *Window = NULL;
 gboolean waiting_for_char = FALSE;
 gboolean waiting_for_timer = FALSE;
 gboolean input_running = FALSE;
@@ -57,7 +74,7 @@ gchar *str = NULL;
 FILE *Fic;
 
 /* Local functions prototype */
-gint Envoie_fichier(GtkFileChooser *FS);
+gint Envoie_fichier(GtkFileChooser *FS, gboolean hex);
 gint Sauve_fichier(GtkFileChooser *FS);
 gint close_all(void);
 void ecriture(gpointer data, gint source, GdkInputCondition condition);
@@ -69,6 +86,8 @@ void write_file(char *, unsigned int);
 
 extern struct configuration_port config;
 
+static gboolean pacing_expired(GIOChannel* src, GIOCondition cond, gpointer data);
+
 gint fichier(GtkWidget *widget, guint param)
 {
     GtkWidget *file_select;
@@ -87,11 +106,14 @@ gint fichier(GtkWidget *widget, guint param)
 	switch(param)
 	{
 	    case 1:
-		Envoie_fichier(GTK_FILE_CHOOSER(file_select));
+		Envoie_fichier(GTK_FILE_CHOOSER(file_select), FALSE);
 		break;
 	    case 2:
 		Sauve_fichier(GTK_FILE_CHOOSER(file_select));
 		break;
+	    case 3:
+		Envoie_fichier(GTK_FILE_CHOOSER(file_select), TRUE);
+		break;
 	}
     }
 
@@ -99,12 +121,281 @@ gint fichier(GtkWidget *widget, guint param)
     return FALSE;
 }
 
-gint Envoie_fichier(GtkFileChooser *FS)
+/* Time needed by the line to send 'bytes', in us */
+static gint64 wire_time(gsize bytes)
+{
+    guint line_rate;
+
+    line_rate = get_line_rate();
+    if(line_rate == 0)
+	return 0;
+
+    return (gint64)bytes * G_USEC_PER_SEC / line_rate;
+}
+
+/* The offsets of the end of every line (just after the LF) are found
+   once for the whole file, the sender then never scans the data */
+static void build_line_index(void)
+{
+    gchar *car, *end;
+    gsize offset;
+
+    line_index = g_array_new(FALSE, FALSE, sizeof(gsize));
+    car = file_map;
+    end = file_map + nb_car;
+
+    while(car < end && (car = memchr(car, LINE_FEED, end - car)) != NULL)
+    {
+	car++;
+	offset = car - file_map;
+	g_array_append_val(line_index, offset);
+    }
+}
+
+static void pacing_start(void)
+{
+    GIOChannel *channel;
+
+    build_line_index();
+    line_delays = g_array_new(FALSE, FALSE, sizeof(gint64));
+    current_line = 0;
+    line_drained = 0;
+    line_draining = FALSE;
+
+#if defined (__linux__)
+    if(config.delai != 0)
+    {
+	pacing_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(pacing_fd == -1)
+	{
+	    perror("timerfd_create");
+	    return;
+	}
+	/* above the redraws, the delay must not wait for them */
+	channel = g_io_channel_unix_new(pacing_fd);
+	pacing_handler = g_io_add_watch_full(channel,
+					     G_PRIORITY_HIGH,
+					     G_IO_IN,
+					     (GIOFunc)pacing_expired,
+					     NULL, NULL);
+	g_io_channel_unref(channel);
+    }
+#endif
+}
+
+static void pacing_end(void)
+{
+    if(pacing_handler != 0)
+	g_source_remove(pacing_handler);
+    pacing_handler = 0;
+    if(pacing_fd != -1)
+	close(pacing_fd);
+    pacing_fd = -1;
+    if(pacing_timeout_handler != 0)
+	g_source_remove(pacing_timeout_handler);
+    pacing_timeout_handler = 0;
+
+    if(line_index != NULL)
+	g_array_free(line_index, TRUE);
+    line_index = NULL;
+    if(line_delays != NULL)
+	g_array_free(line_delays, TRUE);
+    line_delays = NULL;
+}
+
+static gboolean pacing_timeout(gpointer data)
+{
+    pacing_timeout_handler = 0;
+    pacing_expired(NULL, G_IO_IN, NULL);
+    return FALSE;
+}
+
+/* Wakes the sender up in 'delay' us. The timerfd gives sub millisecond
+   accuracy, g_timeout_add() is only the fallback */
+static void pacing_arm(gint64 delay)
+{
+#if defined (__linux__)
+    struct itimerspec when;
+
+    if(pacing_fd != -1)
+    {
+	delay = MAX(delay, 1);
+	memset(&when, 0, sizeof(when));
+	when.it_value.tv_sec = delay / G_USEC_PER_SEC;
+	when.it_value.tv_nsec = (delay % G_USEC_PER_SEC) * 1000;
+	if(timerfd_settime(pacing_fd, 0, &when, NULL) == 0)
+	    return;
+	perror("timerfd_settime");
+    }
+#endif
+    if(pacing_timeout_handler != 0)
+	g_source_remove(pacing_timeout_handler);
+    pacing_timeout_handler = g_timeout_add(MAX((delay + 999) / 1000, 1), (GSourceFunc)pacing_timeout, NULL);
+}
+
+static gboolean pacing_expired(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    guint64 expirations;
+    guint pending;
+
+    if(pacing_fd != -1 && read(pacing_fd, &expirations, sizeof(expirations)) == -1)
+	return TRUE;
+
+    if(waiting_for_timer == FALSE)
+	return TRUE;
+
+    /* the line rate is only an estimation : the delay only starts once
+       the previous line has really left the port, UART included */
+    if(line_draining == TRUE)
+    {
+	pending = get_tx_pending();
+	if(pending != 0 || tx_wire_empty() == FALSE)
+	{
+	    pacing_arm(MAX(wire_time(pending), 100));
+	    return TRUE;
+	}
+	line_draining = FALSE;
+	line_drained = g_get_monotonic_time();
+	pacing_arm((gint64)config.delai * 1000);
+	return TRUE;
+    }
+
+    waiting_for_timer = FALSE;
+    add_input();
+    return TRUE;
+}
+
+/* The first byte of a new line is handed to the port : records the gap
+   achieved since the previous line has left it */
+static void line_begin(void)
+{
+    gint64 gap;
+
+    if(line_drained == 0)
+	return;
+
+    gap = g_get_monotonic_time() - line_drained;
+    g_array_append_val(line_delays, gap);
+    line_drained = 0;
+}
+
+/* Summary of the gaps between the lines */
+static gchar *pacing_report(void)
+{
+    gint64 gap, min, max, total;
+    guint i;
+
+    if(line_delays == NULL || line_delays->len == 0)
+	return g_strdup("");
+
+    min = G_MAXINT64;
+    max = G_MININT64;
+    total = 0;
+    for(i = 0; i < line_delays->len; i++)
+    {
+	gap = g_array_index(line_delays, gint64, i);
+	min = MIN(min, gap);
+	max = MAX(max, gap);
+	total += gap;
+    }
+
+    return g_strdup_printf(_(", %u line gaps of %.2f / %.2f / %.2f ms (min / avg / max)"),
+			   line_delays->len,
+			   (gdouble)min / 1000,
+			   (gdouble)total / line_delays->len / 1000,
+			   (gdouble)max / 1000);
+}
+
+/* Replaces the mapping of a file of hex text or Intel HEX records by
+   the decoded bytes */
+static gboolean decode_hex_file(gchar *NomFichier)
+{
+    gchar *decoded;
+    gssize length;
+    hexparse_t parser;
+    guint line;
+
+    decoded = g_malloc(nb_car / 2 + 2);
+    if(hexparse_is_ihex(file_map, nb_car))
+    {
+	length = hexparse_ihex(file_map, nb_car, decoded, &line);
+	if(length == IHEX_GAP)
+	    str = g_strdup_printf(_("%s: the record at line %u does not follow the previous one, only contiguous Intel HEX images can be sent\n"), NomFichier, line);
+	else if(length == IHEX_INVALID)
+	    str = g_strdup_printf(_("%s: invalid Intel HEX record at line %u\n"), NomFichier, line);
+    }
+    else
+    {
+	hexparse_init(&parser);
+	length = hexparse_feed(&parser, file_map, nb_car, decoded);
+	if(length == -1)
+	    str = g_strdup_printf(_("%s: invalid hex character at offset %lu\n"), NomFichier, (gulong)parser.position);
+	else
+	    length += hexparse_finish(&parser, decoded + length);
+    }
+
+    munmap(file_map, nb_car);
+    file_map = NULL;
+    if(length < 0)
+    {
+	show_message(str, MSG_ERR);
+	g_free(str);
+	str = NULL;
+	g_free(decoded);
+	return FALSE;
+    }
+
+    file_map = decoded;
+    nb_car = length;
+    file_allocated = TRUE;
+
+    return TRUE;
+}
+
+/* file_map holds the data : opens the progress window and starts the
+   sender */
+static void transfer_begin(const gchar *name)
 {
-    gchar *NomFichier;
     gchar *msg;
     GtkWidget *Bouton_annuler, *Box;
 
+    if(config.delai != 0 || config.car != -1)
+	pacing_start();
+
+    msg = g_strdup_printf(_("%s : transfer in progress..."), name);
+
+    gtk_statusbar_push(GTK_STATUSBAR(StatusBar), id, msg);
+
+    Window = gtk_dialog_new();
+    gtk_window_set_title(GTK_WINDOW(Window), msg);
+    g_free(msg);
+    Box = gtk_vbox_new(TRUE, 10);
+    gtk_container_add(GTK_CONTAINER(GTK_DIALOG(Window)->vbox), Box);
+    ProgressBar = gtk_progress_bar_new();
+
+    gtk_box_pack_start(GTK_BOX(Box), ProgressBar, FALSE, FALSE, 5);
+
+    Bouton_annuler = gtk_button_new_with_label(_("Cancel"));
+    gtk_signal_connect_object(GTK_OBJECT(Bouton_annuler), "clicked", GTK_SIGNAL_FUNC(close_all), NULL);
+
+    gtk_container_add(GTK_CONTAINER(GTK_DIALOG(Window)->action_area), Bouton_annuler);
+
+    gtk_signal_connect_object(GTK_OBJECT(Window), "delete_event", GTK_SIGNAL_FUNC(close_all), NULL);
+
+    gtk_window_set_default_size(GTK_WINDOW(Window), 250, 100);
+    gtk_window_set_modal(GTK_WINDOW(Window), TRUE);
+    gtk_widget_show_all(Window);
+
+    transfer_start = g_get_monotonic_time();
+    progress_time = 0;
+    add_input();
+}
+
+gint Envoie_fichier(GtkFileChooser *FS, gboolean hex)
+{
+    gchar *NomFichier;
+    struct stat file_stat;
+
     NomFichier = gtk_file_chooser_get_filename(FS);
 
     if(!g_file_test(NomFichier, G_FILE_TEST_IS_REGULAR))
@@ -116,134 +407,214 @@ gint Envoie_fichier(GtkFileChooser *FS)
 	return FALSE;
     }
     Fichier = open(NomFichier, O_RDONLY);
-    if(Fichier != -1)
+    if(Fichier != -1 && fstat(Fichier, &file_stat) == 0)
     {
-	fic_defaut = g_strdup(NomFichier);
-	msg = g_strdup_printf(_("%s : transfer in progress..."), NomFichier);
-
-	gtk_statusbar_push(GTK_STATUSBAR(StatusBar), id, msg);
+	nb_car = file_stat.st_size;
 	car_written = 0;
-	current_buffer_position = 0;
-	bytes_read = 0;
-	nb_car = lseek(Fichier, 0L, SEEK_END);
-	lseek(Fichier, 0L, SEEK_SET);
-
-	Window = gtk_dialog_new();
-	gtk_window_set_title(GTK_WINDOW(Window), msg);
-	g_free(msg);
-	Box = gtk_vbox_new(TRUE, 10);
-	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(Window)->vbox), Box);
-	ProgressBar = gtk_progress_bar_new();
-	
-	gtk_box_pack_start(GTK_BOX(Box), ProgressBar, FALSE, FALSE, 5);
+	file_map = NULL;
+	file_allocated = FALSE;
 
-	Bouton_annuler = gtk_button_new_with_label(_("Cancel"));
-	gtk_signal_connect_object(GTK_OBJECT(Bouton_annuler), "clicked", GTK_SIGNAL_FUNC(close_all), NULL);
-
-	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(Window)->action_area), Bouton_annuler);
-
-	gtk_signal_connect_object(GTK_OBJECT(Window), "delete_event", GTK_SIGNAL_FUNC(close_all), NULL);
-
-	gtk_window_set_default_size(GTK_WINDOW(Window), 250, 100);
-	gtk_window_set_modal(GTK_WINDOW(Window), TRUE);
-	gtk_widget_show_all(Window);
+	/* the whole file is mapped, the kernel reads it ahead while the
+	   chunks are handed to the transmit queue */
+	if(nb_car != 0)
+	{
+	    file_map = mmap(NULL, nb_car, PROT_READ, MAP_PRIVATE, Fichier, 0);
+	    if(file_map == MAP_FAILED)
+	    {
+		file_map = NULL;
+		str = g_strdup_printf(_("Cannot read file %s: %s\n"), NomFichier, strerror(errno));
+		show_message(str, MSG_ERR);
+		g_free(str);
+		close(Fichier);
+		g_free(NomFichier);
+		return FALSE;
+	    }
+#ifdef MADV_SEQUENTIAL
+	    madvise(file_map, nb_car, MADV_SEQUENTIAL);
+#endif
+	    if(hex == TRUE && decode_hex_file(NomFichier) == FALSE)
+	    {
+		close(Fichier);
+		g_free(NomFichier);
+		return FALSE;
+	    }
+	}
 
-	add_input();
+	fic_defaut = g_strdup(NomFichier);
+	transfer_begin(NomFichier);
     }
     else
     {
 	str = g_strdup_printf(_("Cannot read file %s: %s\n"), NomFichier, strerror(errno));
 	show_message(str, MSG_ERR);
 	g_free(str);
+	if(Fichier != -1)
+	    close(Fichier);
+	Fichier = -1;
     }
     g_free(NomFichier);
     return FALSE;
 }
 
-void ecriture(gpointer data, gint source, GdkInputCondition condition)
+/* Large pasted text : sent like a file, in chunks, with the line delay
+   and the progress window, instead of one write() that the queue cannot
+   take. A paste during a transfer is refused rather than queued : it
+   would go out after the whole file, long after it was made */
+gint send_paste(const gchar *text, gsize length)
 {
-    static gchar buffer[BUFFER_EMISSION];
-    static gchar *current_buffer;
-    static gint bytes_to_write;
-    gint bytes_written;
-    gchar *car;
+    if(length == 0)
+	return FALSE;
 
-    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(ProgressBar), (gfloat)car_written/(gfloat)nb_car );
+    if(serial_port_fd == -1)
+    {
+	Put_temp_message(_("Port not opened!"), 2000);
+	return FALSE;
+    }
 
-    if(car_written < nb_car)
+    if(Window != NULL)
     {
-	/* Read the file only if buffer totally sent or if buffer empty */
-	if(current_buffer_position == bytes_read)
-	{
-	    bytes_read = read(Fichier, buffer, BUFFER_EMISSION);
+	Put_temp_message(_("A transfer is already in progress, paste ignored"), 2000);
+	return FALSE;
+    }
 
-	    current_buffer_position = 0;
-	    current_buffer = buffer;
-	    bytes_to_write = bytes_read;
-	}
+    file_map = g_memdup(text, length);
+    file_allocated = TRUE;
+    nb_car = length;
+    car_written = 0;
+    Fichier = -1;
+
+    transfer_begin(_("Paste"));
 
-    if(current_buffer == NULL)
+    return TRUE;
+}
+
+/* Shows what has really left the port, not what has been queued */
+static void update_progress(void)
+{
+    gint64 now;
+    gsize pending, sent;
+
+    now = g_get_monotonic_time();
+    if(nb_car == 0 || now - progress_time < PROGRESS_INTERVAL * 1000)
+	return;
+    progress_time = now;
+
+    pending = get_tx_pending();
+    sent = car_written - MIN(pending, car_written);
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(ProgressBar), (gfloat)sent/(gfloat)nb_car);
+}
+
+/* Called until the last byte is on the wire, then reports the achieved
+   rate against the limit of the line */
+static gboolean transfer_end(gpointer data)
+{
+    gdouble elapsed, rate;
+    guint line_rate;
+    gchar *msg, *pacing;
+
+    if(get_tx_pending() != 0)
     {
-        /* something went wrong... */
-	    g_free(str);
-	    str = g_strdup_printf(_("Error sending file\n"));
-	    show_message(str, MSG_ERR);
-	    close_all();
-	    return;
+	update_progress();
+	return TRUE;
     }
+    end_handler = 0;
 
-	car = current_buffer;
+    elapsed = (gdouble)(g_get_monotonic_time() - transfer_start) / G_USEC_PER_SEC;
+    rate = elapsed > 0 ? nb_car / elapsed : 0;
+    line_rate = get_line_rate();
+    pacing = pacing_report();
 
-	if(config.delai != 0 || config.car != -1)
-	{
-	    /* search for next LF */
-	    bytes_to_write = current_buffer_position;
-	    while(*car != LINE_FEED && bytes_to_write < bytes_read)
-	    {
-		car++;
-		bytes_to_write++;
-	    }
-	    if(*car == LINE_FEED)
-		bytes_to_write++;
-	}
+    close_all();
 
-	/* write to serial port */
-	bytes_written = send_serial(current_buffer, bytes_to_write - current_buffer_position);
+    if(line_rate != 0)
+	msg = g_strdup_printf(_("%lu bytes sent in %.1f s : %.0f bytes/s, %.0f%% of the line limit (%u bytes/s)%s"),
+			      (gulong)nb_car, elapsed, rate, rate * 100 / line_rate, line_rate, pacing);
+    else
+	msg = g_strdup_printf(_("%lu bytes sent in %.1f s : %.0f bytes/s%s"),
+			      (gulong)nb_car, elapsed, rate, pacing);
+    Put_temp_message(msg, 10000);
+    g_free(msg);
+    g_free(pacing);
 
-	if(bytes_written == -1)
-	{
-	    /* Problem while writing, stop file transfer */
-	    g_free(str);
-	    str = g_strdup_printf(_("Error sending file: %s\n"), strerror(errno));
-	    show_message(str, MSG_ERR);
-	    close_all();
-	    return;
-	}
+    return FALSE;
+}
 
-	car_written += bytes_written;
-	current_buffer_position += bytes_written;
-	current_buffer += bytes_written;
+void ecriture(gpointer data, gint source, GdkInputCondition condition)
+{
+    gsize chunk, length, line_end;
+    gchar *start;
+    gint bytes_written;
 
-	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(ProgressBar), (gfloat)car_written/(gfloat)nb_car );
+    if(car_written >= nb_car)
+    {
+	remove_input();
+	end_handler = g_timeout_add(FILE_POLL, (GSourceFunc)transfer_end, NULL);
+	return;
+    }
 
-	if(config.delai != 0 && *car == LINE_FEED)
-	{
-	    remove_input();
-	    g_timeout_add(config.delai, (GSourceFunc)timer, NULL);
-	    waiting_for_timer = TRUE;
-	}
-	else if(config.car != -1 && *car == LINE_FEED)
-	{
-	    remove_input();
-	    waiting_for_char = TRUE;
-	}
+    /* keep at most one chunk waiting in the transmit queue, so that
+       cancelling stops the transfer quickly */
+    chunk = (gsize)config.file_chunk * 1024;
+    if(get_tx_pending() >= chunk)
+    {
+	/* the port stays writable while the driver drains its own
+	   buffer, so do not spin on it */
+	update_progress();
+	remove_input();
+	g_timeout_add(FILE_POLL, (GSourceFunc)timer, NULL);
+	waiting_for_timer = TRUE;
+	return;
     }
-    else
+
+    start = file_map + car_written;
+    length = MIN(chunk, nb_car - car_written);
+    line_end = nb_car;
+
+    if(line_index != NULL)
     {
+	/* send up to the next LF */
+	if(current_line < line_index->len)
+	    line_end = g_array_index(line_index, gsize, current_line);
+	length = MIN(length, line_end - car_written);
+	if(car_written == (current_line != 0 ? g_array_index(line_index, gsize, current_line - 1) : 0))
+	    line_begin();
+    }
+
+    /* write to serial port */
+    bytes_written = send_serial(start, length);
+
+    if(bytes_written <= 0)
+    {
+	/* there is room in the queue, so the port has been closed */
+	g_free(str);
+	str = g_strdup_printf(_("Error sending file\n"));
+	show_message(str, MSG_ERR);
 	close_all();
 	return;
     }
-    return;
+
+    car_written += bytes_written;
+    update_progress();
+
+    if(line_index == NULL)
+	return;
+    if(car_written != line_end || current_line == line_index->len)
+	return;
+    current_line++;
+
+    if(config.delai != 0)
+    {
+	/* the delay starts when the line has left the port */
+	remove_input();
+	waiting_for_timer = TRUE;
+	line_draining = TRUE;
+	pacing_arm(wire_time(get_tx_pending()));
+    }
+    else if(config.car != -1)
+    {
+	remove_input();
+	waiting_for_char = TRUE;
+    }
 }
 
 gboolean timer(gpointer pointer)
@@ -276,12 +647,31 @@ void remove_input(void)
 
 gint close_all(void)
 {
+    /* cancelled : what is still queued must not go out */
+    if(car_written < nb_car || end_handler != 0)
+	flush_tx();
+    if(end_handler != 0)
+	g_source_remove(end_handler);
+    end_handler = 0;
+
     remove_input();
+    pacing_end();
     waiting_for_char = FALSE;
     waiting_for_timer = FALSE;
     gtk_statusbar_pop(GTK_STATUSBAR(StatusBar), id);
-    close(Fichier);
+    if(file_map != NULL)
+    {
+	if(file_allocated == TRUE)
+	    g_free(file_map);
+	else
+	    munmap(file_map, nb_car);
+    }
+    file_map = NULL;
+    if(Fichier != -1)
+	close(Fichier);
+    Fichier = -1;
     gtk_widget_destroy(Window);
+    Window = NULL;
 
     return FALSE;
 }
@@ -16,8 +16,15 @@
 #define FICHIER_H_
 
 gint fichier(GtkWidget *widget, guint param);
+gint send_paste(const gchar *, gsize);
 void add_input(void);
 
+#define DEFAULT_FILE_CHUNK 64         /* in KB */
+#define MAX_FILE_CHUNK 1024           /* in KB (size of the transmit queue) */
+#define PROGRESS_INTERVAL 250         /* in ms (progress bar updates) */
+#define FILE_POLL 20                  /* in ms (waiting for the queue to drain) */
+#define PASTE_DIRECT 256              /* in bytes : above, the paste is sent like a file */
+
 extern gboolean waiting_for_char;
 extern gchar *fic_defaut;
 
@@ -28,6 +28,11 @@
 #include "buffer.h"
 #include "macros.h"
 #include "auto_config.h"
+#include "detonator.h"
+#include "headless.h"
+#include "logging.h"
+#include "capture.h"
+#include "replay.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
@@ -35,6 +40,8 @@
 int main(int argc, char *argv[])
 {
   gchar *message;
+  gboolean headless;
+  gint status;
 
   config_file = g_strdup_printf("%s/.gtktermrc", getenv("HOME"));
 
@@ -42,11 +49,15 @@ int main(int argc, char *argv[])
   bind_textdomain_codeset(PACKAGE, "UTF-8");
   textdomain(PACKAGE);
 
-  gtk_init(&argc, &argv);
+  /* without window, GTK is not even initialised */
+  headless = headless_command_line(argc, argv);
+  if(!headless)
+    gtk_init(&argc, &argv);
 
   create_buffer();
 
-  create_main_window();
+  if(!headless)
+    create_main_window();
 
   if(read_command_line(argc, argv) < 0)
     {
@@ -54,8 +65,25 @@ int main(int argc, char *argv[])
       exit(1);
     }
 
+  if(headless && !detonator_requested())
+    data_on_stdout = TRUE;
+
   Config_port();
 
+  if(headless)
+    {
+      if(detonator_requested())
+	status = detonator_cli();
+      else
+	status = headless_run();
+      /* the port first : the reader thread may still deliver data */
+      Close_port_and_remove_lockfile();
+      logging_stop();
+      capture_stop();
+      delete_buffer();
+      return status;
+    }
+
   message = get_port_string();
   Set_window_title(message);
   Set_status_message(message);
@@ -66,11 +94,16 @@ int main(int argc, char *argv[])
 
   set_view(ASCII_VIEW);
 
-  gtk_main();
+  if(replay_requested())
+    replay_start(NULL);
 
-  delete_buffer();
+  gtk_main();
 
+  replay_stop();
   Close_port_and_remove_lockfile();
+  logging_stop();
+  capture_stop();
+  delete_buffer();
 
   return 0;
 }
@@ -0,0 +1,422 @@
+/***********************************************************************/
+/* headless.c                                                          */
+/* ----------                                                          */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Runs the serial engine without any window, on a plain          */
+/*      GMainLoop : the received data goes to stdout (and to the       */
+/*      log file), stdin goes to the port. A line of stdin             */
+/*      starting with '~' is a command : ~. quits, ~<shortcut>         */
+/*      sends a macro, ~~ sends a '~'                                  */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+
+#include "term_config.h"
+#include "serie.h"
+#include "buffer.h"
+#include "macros.h"
+#include "headless.h"
+#include "replay.h"
+#include "i18n.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+static GMainLoop *headless_loop = NULL;
+static int headless_signal[2] = {-1, -1};
+static guint callback_handler_stdin = 0;
+static guint callback_handler_retry = 0;
+static gint64 headless_leave = 0;
+static gboolean stdin_line_start = TRUE;
+static GString *stdin_command = NULL;
+static GString *stdin_pending = NULL;
+
+/* stdout is non-blocking : what it does not take at once waits in
+   stdout_pending, from stdout_offset, up to HEADLESS_STDOUT bytes */
+static GString *stdout_pending = NULL;
+static gsize stdout_offset = 0;
+static guint64 stdout_dropped = 0;
+static gboolean stdout_closed = FALSE;
+static gint stdout_flags = -1;
+static guint callback_handler_stdout = 0;
+
+extern struct configuration_port config;
+
+static gboolean stdin_read(GIOChannel* src, GIOCondition cond, gpointer data);
+static gboolean stdout_ready(GIOChannel* src, GIOCondition cond, gpointer data);
+
+/* Writes what stdout takes without blocking, returns the count */
+static gsize stdout_put(const gchar *chars, gsize size)
+{
+    gssize written;
+    gsize done = 0;
+
+    while(done < size && stdout_closed == FALSE)
+    {
+	written = write(STDOUT_FILENO, chars + done, size - done);
+	if(written == -1)
+	{
+	    if(errno == EINTR)
+		continue;
+	    if(errno == EAGAIN)
+		break;
+	    /* nobody reads stdout anymore : only the log is kept */
+	    stdout_closed = TRUE;
+	    break;
+	}
+	done += written;
+    }
+
+    return done;
+}
+
+/* Writes what is queued, FALSE while some is left */
+static gboolean stdout_flush(void)
+{
+    stdout_offset += stdout_put(stdout_pending->str + stdout_offset,
+				stdout_pending->len - stdout_offset);
+    if(stdout_offset < stdout_pending->len && stdout_closed == FALSE)
+	return FALSE;
+
+    g_string_truncate(stdout_pending, 0);
+    stdout_offset = 0;
+    if(stdout_dropped != 0)
+    {
+	i18n_fprintf(stderr, _("\n%llu bytes not written to stdout : it is too slow\n"),
+		     (unsigned long long)stdout_dropped);
+	stdout_dropped = 0;
+    }
+
+    return TRUE;
+}
+
+/* The display of the main window : stdout. The log and the history
+   get the data from the buffer, before : when stdout is too slow, it
+   is the only one to miss some */
+static void headless_write(char *chars, unsigned int size)
+{
+    GIOChannel *channel;
+    gsize done = 0, room;
+
+    if(stdout_closed == TRUE)
+	return;
+
+    if(stdout_pending->len == 0)
+	done = stdout_put(chars, size);
+    if(done == size || stdout_closed == TRUE)
+	return;
+
+    room = HEADLESS_STDOUT - (stdout_pending->len - stdout_offset);
+    if(size - done > room)
+    {
+	stdout_dropped += size - done - room;
+	size = done + room;
+    }
+    if(stdout_offset > 0 && stdout_pending->len + size - done > HEADLESS_STDOUT)
+    {
+	g_string_erase(stdout_pending, 0, stdout_offset);
+	stdout_offset = 0;
+    }
+    g_string_append_len(stdout_pending, chars + done, size - done);
+
+    if(callback_handler_stdout == 0)
+    {
+	channel = g_io_channel_unix_new(STDOUT_FILENO);
+	callback_handler_stdout = g_io_add_watch_full(channel,
+						      10,
+						      G_IO_OUT | G_IO_HUP | G_IO_ERR,
+						      (GIOFunc)stdout_ready,
+						      NULL, NULL);
+	g_io_channel_unref(channel);
+    }
+}
+
+static gboolean stdout_ready(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    if(stdout_flush() == FALSE)
+	return TRUE;
+
+    callback_handler_stdout = 0;
+    return FALSE;
+}
+
+/* At the end, what is queued still goes out, within HEADLESS_LINGER */
+static void stdout_drain(void)
+{
+    struct pollfd output;
+    gint64 leave, now;
+
+    output.fd = STDOUT_FILENO;
+    output.events = POLLOUT;
+    leave = g_get_monotonic_time() + (gint64)HEADLESS_LINGER * 1000;
+    while(stdout_flush() == FALSE && (now = g_get_monotonic_time()) < leave)
+	poll(&output, 1, (leave - now) / 1000 + 1);
+
+    if(stdout_offset < stdout_pending->len)
+    {
+	stdout_dropped += stdout_pending->len - stdout_offset;
+	g_string_truncate(stdout_pending, 0);
+	stdout_offset = 0;
+	stdout_closed = TRUE;
+	stdout_flush();
+    }
+}
+
+static void headless_interrupt(int signal)
+{
+    if(write(headless_signal[1], "", 1) == -1)
+	return;
+}
+
+static gboolean headless_quit(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    g_main_loop_quit(headless_loop);
+    return FALSE;
+}
+
+/* the end of a replay ends the session */
+static void headless_replay_done(void)
+{
+    g_main_loop_quit(headless_loop);
+}
+
+static void stdin_watch(void)
+{
+    GIOChannel *channel;
+
+    channel = g_io_channel_unix_new(STDIN_FILENO);
+    callback_handler_stdin = g_io_add_watch_full(channel,
+						 10,
+						 G_IO_IN | G_IO_HUP | G_IO_ERR,
+						 (GIOFunc)stdin_read,
+						 NULL, NULL);
+    g_io_channel_unref(channel);
+}
+
+/* Sends what is pending, FALSE if the queue is full */
+static gboolean stdin_flush(void)
+{
+    gint queued;
+
+    if(stdin_pending->len == 0)
+	return TRUE;
+    if(serial_port_fd == -1)
+    {
+	g_string_truncate(stdin_pending, 0);
+	return TRUE;
+    }
+
+    queued = Send_chars(stdin_pending->str, stdin_pending->len);
+    g_string_erase(stdin_pending, 0, MAX(queued, 0));
+
+    return stdin_pending->len == 0;
+}
+
+static gboolean stdin_retry(gpointer data)
+{
+    if(stdin_flush() == FALSE)
+	return TRUE;
+
+    callback_handler_retry = 0;
+    stdin_watch();
+    return FALSE;
+}
+
+/* ~. : what was typed before still goes out, within HEADLESS_LINGER */
+static gboolean stdin_linger(gpointer data)
+{
+    if((stdin_flush() == FALSE || get_tx_pending() != 0) &&
+       g_get_monotonic_time() < headless_leave)
+	return TRUE;
+
+    callback_handler_retry = 0;
+    g_main_loop_quit(headless_loop);
+    return FALSE;
+}
+
+static void stdin_execute(const gchar *command)
+{
+    macro_t *macros;
+    gint i, size;
+
+    if(!strcmp(command, "."))
+    {
+	headless_leave = g_get_monotonic_time() + (gint64)HEADLESS_LINGER * 1000;
+	return;
+    }
+
+    if(command[0] == HEADLESS_ESCAPE)
+    {
+	g_string_append(stdin_pending, command);
+	g_string_append_c(stdin_pending, '\n');
+	return;
+    }
+
+    macros = get_shortcuts(&size);
+    for(i = 0; i < size; i++)
+    {
+	if(!g_ascii_strcasecmp(macros[i].shortcut, command))
+	{
+	    g_string_append_len(stdin_pending, macros[i].data, macros[i].length);
+	    return;
+	}
+    }
+    i18n_fprintf(stderr, _("No macro for the shortcut %s\n"), command);
+}
+
+static gboolean stdin_read(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    gchar chars[HEADLESS_STDIN];
+    gssize bytes_read, i;
+
+    bytes_read = read(STDIN_FILENO, chars, sizeof(chars));
+    if(bytes_read == -1 && (errno == EINTR || errno == EAGAIN))
+	return TRUE;
+    if(bytes_read <= 0)
+    {
+	/* stdin closed : keep capturing */
+	callback_handler_stdin = 0;
+	return FALSE;
+    }
+
+    for(i = 0; i < bytes_read; i++)
+    {
+	if(stdin_command != NULL)
+	{
+	    if(chars[i] != '\n')
+	    {
+		if(stdin_command->len < HEADLESS_COMMAND)
+		    g_string_append_c(stdin_command, chars[i]);
+		continue;
+	    }
+	    stdin_execute(stdin_command->str);
+	    g_string_free(stdin_command, TRUE);
+	    stdin_command = NULL;
+	    stdin_line_start = TRUE;
+	    if(headless_leave != 0)
+		break;
+	}
+	else if(stdin_line_start && chars[i] == HEADLESS_ESCAPE)
+	    stdin_command = g_string_new(NULL);
+	else
+	{
+	    g_string_append_c(stdin_pending, chars[i]);
+	    stdin_line_start = (chars[i] == '\n');
+	}
+    }
+
+    if(headless_leave != 0)
+    {
+	/* the rest of stdin is ignored */
+	callback_handler_stdin = 0;
+	callback_handler_retry = g_timeout_add(HEADLESS_RETRY, stdin_linger, NULL);
+	return FALSE;
+    }
+
+    if(stdin_flush() == TRUE)
+	return TRUE;
+
+    /* the port is slower than stdin : stop reading until there is room */
+    callback_handler_stdin = 0;
+    callback_handler_retry = g_timeout_add(HEADLESS_RETRY, stdin_retry, NULL);
+    return FALSE;
+}
+
+/* Until SIGINT, SIGTERM or ~. on stdin */
+gint headless_run(void)
+{
+    struct sigaction action;
+    GIOChannel *channel;
+    guint callback_handler_signal;
+    gint status = 0;
+
+    /* a replay does not need the port */
+    if(serial_port_fd == -1 && !replay_requested())
+	return 1;
+
+    if(pipe(headless_signal) == -1)
+    {
+	perror("pipe");
+	return 1;
+    }
+    fcntl(headless_signal[1], F_SETFL, O_NONBLOCK);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = headless_interrupt;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
+
+    headless_loop = g_main_loop_new(NULL, FALSE);
+    channel = g_io_channel_unix_new(headless_signal[0]);
+    callback_handler_signal = g_io_add_watch_full(channel,
+						  G_PRIORITY_HIGH,
+						  G_IO_IN,
+						  (GIOFunc)headless_quit,
+						  NULL, NULL);
+    g_io_channel_unref(channel);
+
+    stdin_pending = g_string_new(NULL);
+    headless_leave = 0;
+    stdin_watch();
+    stdout_pending = g_string_new(NULL);
+    stdout_offset = 0;
+    stdout_dropped = 0;
+    stdout_closed = FALSE;
+    stdout_flags = fcntl(STDOUT_FILENO, F_GETFL);
+    if(stdout_flags != -1)
+	fcntl(STDOUT_FILENO, F_SETFL, stdout_flags | O_NONBLOCK);
+    set_display_func(headless_write);
+
+    if(serial_port_fd != -1)
+	i18n_fprintf(stderr, _("%s opened, Ctrl-C or ~. to quit\n"), config.port);
+    if(replay_requested() && replay_start(headless_replay_done) == FALSE)
+	status = 1;
+    else
+	g_main_loop_run(headless_loop);
+
+    replay_stop();
+    unset_display_func(headless_write);
+    if(callback_handler_stdout != 0)
+	g_source_remove(callback_handler_stdout);
+    callback_handler_stdout = 0;
+    stdout_drain();
+    /* the shell shares the terminal : it gets it back as it was */
+    if(stdout_flags != -1)
+	fcntl(STDOUT_FILENO, F_SETFL, stdout_flags);
+    g_string_free(stdout_pending, TRUE);
+    stdout_pending = NULL;
+    if(callback_handler_stdin != 0)
+	g_source_remove(callback_handler_stdin);
+    if(callback_handler_retry != 0)
+	g_source_remove(callback_handler_retry);
+    callback_handler_stdin = 0;
+    callback_handler_retry = 0;
+    g_source_remove(callback_handler_signal);
+    g_main_loop_unref(headless_loop);
+    headless_loop = NULL;
+    close(headless_signal[0]);
+    close(headless_signal[1]);
+    g_string_free(stdin_pending, TRUE);
+    if(stdin_command != NULL)
+	g_string_free(stdin_command, TRUE);
+    stdin_command = NULL;
+
+    return status;
+}
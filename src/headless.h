@@ -0,0 +1,29 @@
+/***********************************************************************/
+/* headless.h                                                          */
+/* ----------                                                          */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Runs the serial engine without any window                      */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef HEADLESS_H_
+#define HEADLESS_H_
+
+#include <glib.h>
+
+#define HEADLESS_ESCAPE '~'       /* at the start of a line of stdin */
+#define HEADLESS_COMMAND 128      /* max length of an escape command */
+#define HEADLESS_STDIN 4096       /* bytes read from stdin at once */
+#define HEADLESS_STDOUT (1024 * 1024) /* max bytes queued for stdout */
+#define HEADLESS_RETRY 10         /* in ms (transmit queue full) */
+#define HEADLESS_LINGER 2000      /* in ms, max wait for the queue on ~. */
+
+gint headless_run(void);
+
+#endif
@@ -0,0 +1,215 @@
+/***********************************************************************/
+/* hexparse.c                                                          */
+/* ----------                                                          */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Hexadecimal text and Intel HEX decoding.                       */
+/*      One pass over the text with a character class table :          */
+/*      no token array, no sscanf()                                    */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+#include <string.h>
+
+#include "hexparse.h"
+
+#define HEX_SEPARATOR 0x10
+#define HEX_PREFIX 0x11
+#define HEX_INVALID 0xFF
+
+/* Value of the hex digits, or the class of the other characters */
+static const guint8 hex_class[256] =
+{
+    /* 0x00 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x10, 0x10, 0xFF, 0xFF, 0x10, 0xFF, 0xFF,
+    /* 0x10 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0x20 */ 0x10, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x10, 0x10, 0xFF, 0xFF,
+    /* 0x30 */ 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x10, 0x10, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0x40 */ 0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0x50 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x11, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0x60 */ 0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0x70 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x11, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0x80 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0x90 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0xA0 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0xB0 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0xC0 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0xD0 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0xE0 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    /* 0xF0 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+void hexparse_init(hexparse_t *parser)
+{
+    parser->nibble = -1;
+    parser->digits = 0;
+    parser->position = 0;
+}
+
+/* Ends a token : a lone digit is a whole byte ("A" is 0x0A) */
+static inline gchar *hexparse_token_end(hexparse_t *parser, gchar *out)
+{
+    if(parser->nibble != -1)
+	*out++ = parser->nibble;
+    parser->nibble = -1;
+    parser->digits = 0;
+
+    return out;
+}
+
+/* Decodes 'size' characters from 'in' into 'out', which must hold
+   size / 2 + 1 bytes. Tokens are separated by blanks, ',', ';', ':' or
+   '-', may start with "0x" and may hold any number of digits, taken two
+   by two. Returns the number of bytes written, or -1 on an invalid
+   character, which is then at parser->position */
+gssize hexparse_feed(hexparse_t *parser, const gchar *in, gsize size, gchar *out)
+{
+    const guint8 *car, *end;
+    gchar *start = out;
+    guint8 class;
+
+    car = (const guint8 *)in;
+    end = car + size;
+
+    while(car < end)
+    {
+	class = hex_class[*car];
+	if(class < 16)
+	{
+	    if(parser->nibble == -1)
+		parser->nibble = class;
+	    else
+	    {
+		*out++ = (parser->nibble << 4) | class;
+		parser->nibble = -1;
+	    }
+	    parser->digits++;
+	}
+	else if(class == HEX_SEPARATOR)
+	    out = hexparse_token_end(parser, out);
+	else if(class == HEX_PREFIX && parser->digits == 1 && parser->nibble == 0)
+	{
+	    /* "0x" : the 0 was not a digit */
+	    parser->nibble = -1;
+	    parser->digits = 0;
+	}
+	else
+	{
+	    parser->position += (const gchar *)car - in;
+	    return -1;
+	}
+	car++;
+    }
+    parser->position += size;
+
+    return out - start;
+}
+
+/* Flushes the last token, 'out' must hold 1 byte */
+gsize hexparse_finish(hexparse_t *parser, gchar *out)
+{
+    return hexparse_token_end(parser, out) - out;
+}
+
+gboolean hexparse_is_ihex(const gchar *in, gsize size)
+{
+    const gchar *end = in + size;
+
+    while(in < end && *in != ':' && hex_class[(guint8)*in] == HEX_SEPARATOR)
+	in++;
+
+    return (in < end && *in == ':');
+}
+
+static inline gint hexparse_byte(const guint8 *car)
+{
+    if(hex_class[car[0]] >= 16 || hex_class[car[1]] >= 16)
+	return -1;
+
+    return (hex_class[car[0]] << 4) | hex_class[car[1]];
+}
+
+/* Decodes an Intel HEX file into the contiguous image it describes :
+   the first data record gives the start address, and each following
+   one must begin where the previous one ended, the extended segment
+   (02) and linear (04) addresses included. 'out' must hold size / 2
+   bytes. Returns the number of bytes written, or IHEX_INVALID or
+   IHEX_GAP with the number of the faulty line in *line */
+gssize hexparse_ihex(const gchar *in, gsize size, gchar *out, guint *line)
+{
+    const guint8 *car, *end;
+    gchar *start = out;
+    gint length, type, value, i;
+    guint8 checksum;
+    guint32 base = 0, address, next = 0;
+    gssize error = IHEX_INVALID;
+
+    car = (const guint8 *)in;
+    end = car + size;
+    *line = 0;
+
+    while(car < end)
+    {
+	/* blank lines and line ends */
+	if(*car != ':' && hex_class[*car] == HEX_SEPARATOR)
+	{
+	    if(*car == '\n')
+		(*line)++;
+	    car++;
+	    continue;
+	}
+
+	/* ':' length(2) address(4) type(2) data(2 * length) checksum(2) */
+	if(*car != ':' || end - car < 11 || (length = hexparse_byte(car + 1)) == -1 ||
+	   end - car < 11 + 2 * length)
+	    break;
+	type = hexparse_byte(car + 7);
+	checksum = 0;
+	for(i = 0; i < length + 5; i++)
+	{
+	    value = hexparse_byte(car + 1 + 2 * i);
+	    if(value == -1)
+		break;
+	    checksum += value;
+	}
+	if(i != length + 5 || checksum != 0)
+	    break;
+
+	if(type == 0x00 && length != 0)
+	{
+	    address = base + ((hexparse_byte(car + 3) << 8) | hexparse_byte(car + 5));
+	    if(out != start && address != next)
+	    {
+		error = IHEX_GAP;
+		break;
+	    }
+	    next = address + length;
+	    for(i = 0; i < length; i++)
+		*out++ = hexparse_byte(car + 9 + 2 * i);
+	}
+	else if(type == 0x02 || type == 0x04)
+	{
+	    if(length != 2)
+		break;
+	    base = (hexparse_byte(car + 9) << 8) | hexparse_byte(car + 11);
+	    base <<= (type == 0x02) ? 4 : 16;
+	}
+	else if(type > 0x05)
+	    break;
+	car += 11 + 2 * length;
+
+	/* end of file record */
+	if(type == 0x01)
+	    return out - start;
+    }
+
+    if(car >= end)
+	return out - start;
+
+    (*line)++;
+    return error;
+}
@@ -0,0 +1,37 @@
+/***********************************************************************/
+/* hexparse.h                                                          */
+/* ----------                                                          */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Hexadecimal text and Intel HEX decoding                        */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef HEXPARSE_H_
+#define HEXPARSE_H_
+
+#include <glib.h>
+
+/* Streaming decoder state, so that the text can be fed in pieces */
+typedef struct
+{
+    gint nibble;           /* pending high nibble, -1 if none */
+    gint digits;           /* hex digits in the current token */
+    gsize position;        /* characters consumed so far */
+} hexparse_t;
+
+void hexparse_init(hexparse_t *);
+gssize hexparse_feed(hexparse_t *, const gchar *, gsize, gchar *);
+gsize hexparse_finish(hexparse_t *, gchar *);
+#define IHEX_INVALID -1        /* malformed record */
+#define IHEX_GAP -2            /* data record not where the previous one ended */
+
+gssize hexparse_ihex(const gchar *, gsize, gchar *, guint *);
+gboolean hexparse_is_ihex(const gchar *, gsize);
+
+#endif
@@ -0,0 +1,153 @@
+/***********************************************************************/
+/* hexview.c                                                           */
+/* ---------                                                           */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Hexadecimal view formatter : whole rows (index, hex and ASCII  */
+/*      columns) are formatted in one buffer with lookup tables        */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+#include <string.h>
+
+#include "hexview.h"
+
+#define HEX_INDEX_WIDTH 12      /* "%6u: " with up to 10 digits */
+#define HEX_ASCII_GAP 3
+
+static gchar hex_table[256][3];
+static gchar ascii_table[256];
+static gboolean tables_ready = FALSE;
+
+static void hex_init_tables(void)
+{
+    static const gchar digits[] = "0123456789ABCDEF";
+    gint i;
+
+    for(i = 0; i < 256; i++)
+    {
+	hex_table[i][0] = digits[i >> 4];
+	hex_table[i][1] = digits[i & 0x0F];
+	hex_table[i][2] = ' ';
+	ascii_table[i] = (i >= 0x20 && i < 0x7F) ? (gchar)i : '.';
+    }
+    tables_ready = TRUE;
+}
+
+void hex_init(hex_state_t *state, guint bytes_per_line, gboolean show_index)
+{
+    if(tables_ready == FALSE)
+	hex_init_tables();
+
+    state->bytes_per_line = CLAMP(bytes_per_line, 2, HEX_MAX_BYTES_PER_LINE);
+    state->show_index = show_index;
+    state->total_bytes = 0;
+    state->row_bytes = 0;
+}
+
+/* Width of the hex column : "XX " per byte, plus "- " in the middle */
+static guint hex_column_width(hex_state_t *state)
+{
+    return state->bytes_per_line * 3 + 2;
+}
+
+/* Writes one row from state->row (complete or not) at 'out', returns the
+   number of chars written */
+static gsize hex_format_row(hex_state_t *state, gchar *out)
+{
+    gchar *start = out;
+    guint i, half, pad;
+
+    if(state->show_index)
+    {
+	out += g_snprintf(out, HEX_INDEX_WIDTH + 1, "%6u: ", state->total_bytes);
+    }
+
+    half = state->bytes_per_line / 2;
+    for(i = 0; i < state->row_bytes; i++)
+    {
+	memcpy(out, hex_table[state->row[i]], 3);
+	out += 3;
+	if(i == half - 1)
+	{
+	    *out++ = '-';
+	    *out++ = ' ';
+	}
+    }
+
+    /* pad the hex column so that the ASCII column is always aligned */
+    pad = hex_column_width(state) - (state->row_bytes * 3 + (state->row_bytes >= half ? 2 : 0));
+    memset(out, ' ', pad + HEX_ASCII_GAP);
+    out += pad + HEX_ASCII_GAP;
+
+    for(i = 0; i < state->row_bytes; i++)
+	*out++ = ascii_table[state->row[i]];
+
+    return out - start;
+}
+
+/* Appends the rendering of 'data' to 'out'. Complete rows are terminated by
+   \r\n ; a trailing partial row is drawn too, and redrawn from the start of
+   the line (\r + erase line) when the next bytes arrive. */
+void hex_format(hex_state_t *state, const guchar *data, gsize size, GString *out)
+{
+    gsize row_width, max_size, length, copy;
+    gchar *p;
+
+    if(size == 0)
+	return;
+
+    row_width = HEX_INDEX_WIDTH + hex_column_width(state) + HEX_ASCII_GAP + state->bytes_per_line + 2;
+    max_size = 4 + (size / state->bytes_per_line + 2) * row_width;
+
+    length = out->len;
+    g_string_set_size(out, length + max_size);
+    p = out->str + length;
+
+    if(state->row_bytes != 0)
+    {
+	memcpy(p, "\r\033[K", 4);
+	p += 4;
+    }
+
+    while(size > 0)
+    {
+	copy = MIN(size, state->bytes_per_line - state->row_bytes);
+	memcpy(state->row + state->row_bytes, data, copy);
+	state->row_bytes += copy;
+	data += copy;
+	size -= copy;
+
+	p += hex_format_row(state, p);
+
+	if(state->row_bytes == state->bytes_per_line)
+	{
+	    *p++ = '\r';
+	    *p++ = '\n';
+	    state->total_bytes += state->row_bytes;
+	    state->row_bytes = 0;
+	}
+    }
+
+    g_string_truncate(out, p - out->str);
+}
+
+/* "%02X " for each byte, as used for the log file ; 'out' must hold
+   3 * size chars */
+gsize hex_dump_bytes(const guchar *data, gsize size, gchar *out)
+{
+    gsize i;
+
+    if(tables_ready == FALSE)
+	hex_init_tables();
+
+    for(i = 0; i < size; i++)
+	memcpy(out + i * 3, hex_table[data[i]], 3);
+
+    return size * 3;
+}
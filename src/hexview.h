@@ -0,0 +1,35 @@
+/***********************************************************************/
+/* hexview.h                                                           */
+/* ---------                                                           */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Hexadecimal view formatter                                     */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef HEXVIEW_H_
+#define HEXVIEW_H_
+
+#include <glib.h>
+
+#define HEX_MAX_BYTES_PER_LINE 32
+
+typedef struct
+{
+    guint bytes_per_line;
+    gboolean show_index;
+    guint total_bytes;                 /* index of the first byte of the row */
+    guint row_bytes;                   /* bytes already in the current row */
+    guchar row[HEX_MAX_BYTES_PER_LINE];
+} hex_state_t;
+
+void hex_init(hex_state_t *, guint, gboolean);
+void hex_format(hex_state_t *, const guchar *, gsize, GString *);
+gsize hex_dump_bytes(const guchar *, gsize, gchar *);
+
+#endif
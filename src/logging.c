@@ -22,23 +22,770 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
 #include <glib.h>
+#include <pthread.h>
 
 #include "widgets.h"
 #include "serie.h"
 #include "buffer.h"
 #include "logging.h"
+#include "i18n.h"
+#include "hexview.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
 
-#define MAX_WRITE_ATTEMPTS 5
+/* The data is copied into one of LOG_BUFFERS buffers, which is handed
+   to a writer thread when it is full or when the flush policy says so.
+   When all the buffers are waiting for the disk, more are allocated, up
+   to LOG_BUFFERS_MAX. Beyond, the receive path waits for the writer
+   thread : no data is ever left out of the log. The errors
+   of the writer thread come back to the main loop through log_wakeup.
+   The buffers hold the raw received bytes : the hex and timestamped
+   formats are made by the writer thread */
+typedef struct {
+    gchar *data;
+    gsize used;
+} log_buffer_t;
+
+/* In LOG_FORMAT_TIMESTAMP, each piece of data in a buffer follows its
+   arrival time */
+typedef struct {
+    gint64 time;
+    guint32 size;
+} log_record_t;
 
 static gboolean	  Logging;
 static gchar     *LoggingFileName;
-static FILE      *LoggingFile;
+static int        log_fd = -1;
 static gchar     *logfile_default = NULL;
 
+static log_buffer_t log_buffers[LOG_BUFFERS_MAX];
+static gint log_allocated = 0;
+static log_buffer_t *log_current = NULL;
+static log_buffer_t *log_spare[LOG_BUFFERS_MAX];
+static gint log_spares = 0;
+static log_buffer_t *log_queue[LOG_BUFFERS_MAX];
+static gint log_queue_head = 0;
+static gint log_queued = 0;
+static pthread_t log_thread;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_idle = PTHREAD_COND_INITIALIZER;
+static gboolean log_quit = FALSE;
+static volatile gint log_errno = 0;
+static volatile gint log_behind = 0;
+static guint64 log_waits = 0;
+static int log_wakeup[2] = {-1, -1};
+static guint callback_handler_log = 0;
+static guint callback_handler_flush = 0;
+
+/* Flush policy */
+static gint log_flush_policy = LOG_FLUSH_MS;
+static guint log_flush_value = LOG_FLUSH_DEFAULT_MS;
+
+/* Format : log_format is the choice for the next file, log_session_format
+   the one of the file being written */
+static gint log_format = LOG_FORMAT_RAW;
+static gint log_session_format = LOG_FORMAT_RAW;
+static const gchar *log_format_names[] = {"raw", "hex", "timestamp"};
+
+/* Writer thread only */
+static gchar log_text[LOG_TEXT_SIZE];
+static gsize log_text_used = 0;
+static guint log_hex_column = 0;
+static gboolean log_line_start = TRUE;
+
+/* Rotation : once the file is too big or too old, the writer thread
+   renames it to <file>-<date> and goes on in a new <file>. The rotated
+   segments are listed in <file>.index, and compressed by another
+   thread */
+static guint64 log_rotate_size = 0;           /* in bytes, 0 : no limit */
+static gint64 log_rotate_age = 0;             /* in us, 0 : no limit */
+static gint log_rotate_keep = LOG_ROTATE_KEEP;
+static gboolean log_rotate_gzip = FALSE;
+static guint64 log_segment_bytes = 0;         /* writer thread and logging_clear() */
+static gint64 log_segment_opened = 0;
+static gint64 log_segment_start = 0;
+static guint64 log_offset = 0;
+static GQueue *log_segments = NULL;
+
+/* Compression thread : it also removes the old segments, once their
+   compression is over */
+typedef struct
+{
+    gchar *name;
+    gboolean remove;
+} compress_job_t;
+
+static pthread_t compress_thread;
+static gboolean compress_active = FALSE;
+static gboolean compress_quit = FALSE;
+static pthread_mutex_t compress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compress_work = PTHREAD_COND_INITIALIZER;
+static GQueue *compress_queue = NULL;
+
+static void logging_fail(gint error)
+{
+    if(g_atomic_int_compare_and_exchange(&log_errno, 0, error))
+    {
+	if(write(log_wakeup[1], "", 1) == -1)
+	    perror("log wakeup");
+    }
+}
+
+/* After an error, the rest is thrown away until the stop */
+static void logging_write(const gchar *data, gsize size)
+{
+    gssize written;
+    gsize done = 0;
+
+    while(done < size && g_atomic_int_get(&log_errno) == 0)
+    {
+	written = write(log_fd, data + done, size - done);
+	if(written == -1 && errno == EINTR)
+	    continue;
+	if(written <= 0)
+	{
+	    logging_fail(written == -1 ? errno : ENOSPC);
+	    break;
+	}
+	done += written;
+    }
+    log_segment_bytes += done;
+}
+
+static void compress_setup(gpointer data)
+{
+    /* the compression must not take the CPU from the capture */
+    if(nice(LOG_COMPRESS_NICE) == -1)
+	return;
+}
+
+/* A ".gz" segment may not have been compressed (gzip failed, or the
+   previous session ended first) : both names go */
+static void logging_remove(const gchar *segment)
+{
+    gchar *name;
+
+    unlink(segment);
+    if(g_str_has_suffix(segment, ".gz"))
+    {
+	name = g_strndup(segment, strlen(segment) - 3);
+	unlink(name);
+	g_free(name);
+    }
+}
+
+static void *compress_main(void *data)
+{
+    gchar *argv[] = {"gzip", "-f", NULL, NULL};
+    GError *error = NULL;
+    compress_job_t *job;
+    gint status;
+
+    pthread_mutex_lock(&compress_lock);
+    while(1)
+    {
+	while(g_queue_is_empty(compress_queue) && compress_quit == FALSE)
+	    pthread_cond_wait(&compress_work, &compress_lock);
+	if(g_queue_is_empty(compress_queue))
+	    break;
+	job = g_queue_pop_head(compress_queue);
+	pthread_mutex_unlock(&compress_lock);
+	argv[2] = job->name;
+
+	if(job->remove)
+	    logging_remove(job->name);
+	else if(g_spawn_sync(NULL, argv, NULL,
+			G_SPAWN_SEARCH_PATH | G_SPAWN_STDOUT_TO_DEV_NULL,
+			compress_setup, NULL, NULL, NULL, &status, &error) == FALSE)
+	{
+	    i18n_fprintf(stderr, _("Cannot compress %s: %s\n"), argv[2], error->message);
+	    g_clear_error(&error);
+	}
+	else if(status != 0)
+	    i18n_fprintf(stderr, _("Cannot compress %s\n"), argv[2]);
+	g_free(job->name);
+	g_free(job);
+
+	pthread_mutex_lock(&compress_lock);
+    }
+    pthread_mutex_unlock(&compress_lock);
+
+    return NULL;
+}
+
+/* The thread is started with the first rotation of the log, and stopped
+   with it by compress_end(). The jobs are done in order, so a segment
+   is only removed after its compression */
+static void logging_compress(const gchar *name, gboolean remove)
+{
+    compress_job_t *job;
+
+    job = g_new(compress_job_t, 1);
+    job->name = g_strdup(name);
+    job->remove = remove;
+
+    pthread_mutex_lock(&compress_lock);
+    if(compress_queue == NULL)
+	compress_queue = g_queue_new();
+    g_queue_push_tail(compress_queue, job);
+    pthread_cond_signal(&compress_work);
+    pthread_mutex_unlock(&compress_lock);
+
+    if(compress_active == FALSE)
+    {
+	if(pthread_create(&compress_thread, NULL, compress_main, NULL) != 0)
+	{
+	    perror("log compression");
+	    return;
+	}
+	compress_active = TRUE;
+    }
+}
+
+/* Waits until the queued jobs are done : a compression is not cut by
+   the end of the log, and no half written ".gz" is left behind */
+static void compress_end(void)
+{
+    if(compress_active == FALSE)
+	return;
+
+    pthread_mutex_lock(&compress_lock);
+    compress_quit = TRUE;
+    pthread_cond_signal(&compress_work);
+    pthread_mutex_unlock(&compress_lock);
+    pthread_join(compress_thread, NULL);
+
+    compress_quit = FALSE;
+    compress_active = FALSE;
+}
+
+/* "<first byte offset> <size> <start time> <end time> <segment>" */
+static void logging_index(const gchar *segment, gint64 end)
+{
+    gchar *index_name;
+    gchar start_date[LOG_STAMP_SIZE], end_date[LOG_STAMP_SIZE];
+    struct tm date;
+    time_t seconds;
+    FILE *index;
+
+    index_name = g_strdup_printf("%s.index", LoggingFileName);
+    index = fopen(index_name, "a");
+    g_free(index_name);
+    if(index == NULL)
+    {
+	logging_fail(errno);
+	return;
+    }
+
+    seconds = log_segment_start / G_USEC_PER_SEC;
+    localtime_r(&seconds, &date);
+    strftime(start_date, sizeof(start_date), "%Y-%m-%dT%H:%M:%S", &date);
+    seconds = end / G_USEC_PER_SEC;
+    localtime_r(&seconds, &date);
+    strftime(end_date, sizeof(end_date), "%Y-%m-%dT%H:%M:%S", &date);
+
+    fprintf(index, "%llu %llu %s %s %s\n",
+	    (unsigned long long)log_offset, (unsigned long long)log_segment_bytes,
+	    start_date, end_date, segment);
+    if(fclose(index) == EOF)
+	logging_fail(errno);
+}
+
+/* The segments of the previous sessions are still counted by "keep" */
+static void logging_index_read(void)
+{
+    gchar *index_name, line[LOG_INDEX_LINE];
+    unsigned long long offset, size;
+    gint position;
+    FILE *index;
+
+    log_offset = 0;
+    if(log_segments == NULL)
+	log_segments = g_queue_new();
+    while(!g_queue_is_empty(log_segments))
+	g_free(g_queue_pop_head(log_segments));
+
+    index_name = g_strdup_printf("%s.index", LoggingFileName);
+    index = fopen(index_name, "r");
+    g_free(index_name);
+    if(index == NULL)
+	return;
+
+    while(fgets(line, sizeof(line), index) != NULL)
+    {
+	g_strchomp(line);
+	if(sscanf(line, "%llu %llu %*s %*s %n", &offset, &size, &position) < 2)
+	    continue;
+	log_offset = offset + size;
+	g_queue_push_tail(log_segments, g_strdup(line + position));
+    }
+    fclose(index);
+}
+
+static gboolean logging_segment_exists(const gchar *segment)
+{
+    gchar *compressed;
+    gboolean exists;
+
+    if(g_file_test(segment, G_FILE_TEST_EXISTS))
+	return TRUE;
+
+    compressed = g_strdup_printf("%s.gz", segment);
+    exists = g_file_test(compressed, G_FILE_TEST_EXISTS);
+    g_free(compressed);
+
+    return exists;
+}
+
+static void logging_rotate(void)
+{
+    gchar *segment, *name;
+    gchar date_text[LOG_STAMP_SIZE];
+    struct tm date;
+    time_t seconds;
+    gint64 now = g_get_real_time();
+    gint fd, i;
+
+    seconds = now / G_USEC_PER_SEC;
+    localtime_r(&seconds, &date);
+    strftime(date_text, sizeof(date_text), "%Y%m%d-%H%M%S", &date);
+    segment = g_strdup_printf("%s-%s", LoggingFileName, date_text);
+    for(i = 1; logging_segment_exists(segment); i++)
+    {
+	g_free(segment);
+	segment = g_strdup_printf("%s-%s-%d", LoggingFileName, date_text, i);
+    }
+
+    /* the data still written by the capture goes on in the new file :
+       log_fd is kept, pointing to it */
+    if(rename(LoggingFileName, segment) == -1)
+    {
+	logging_fail(errno);
+	g_free(segment);
+	return;
+    }
+    fd = open(LoggingFileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd == -1 || dup2(fd, log_fd) == -1)
+    {
+	logging_fail(errno);
+	if(fd != -1)
+	    close(fd);
+	g_free(segment);
+	return;
+    }
+    close(fd);
+
+    if(log_rotate_gzip)
+    {
+	logging_compress(segment, FALSE);
+	name = g_strdup_printf("%s.gz", segment);
+	g_free(segment);
+	segment = name;
+    }
+    logging_index(segment, now);
+    g_queue_push_tail(log_segments, segment);
+
+    while(log_rotate_keep > 0 && (gint)g_queue_get_length(log_segments) > log_rotate_keep)
+    {
+	name = g_queue_pop_head(log_segments);
+	if(log_rotate_gzip)
+	    logging_compress(name, TRUE);
+	else
+	    logging_remove(name);
+	g_free(name);
+    }
+
+    log_offset += log_segment_bytes;
+    log_segment_bytes = 0;
+    log_segment_opened = g_get_monotonic_time();
+    log_segment_start = now;
+}
+
+/* An idle port : the segment holding data still rotates on age. Called
+   with log_lock held, as logging_clear() changes the segment */
+static gboolean logging_rotate_due(void)
+{
+    return log_rotate_age != 0 && log_segment_bytes != 0 &&
+	g_atomic_int_get(&log_errno) == 0 &&
+	g_get_monotonic_time() - log_segment_opened >= log_rotate_age;
+}
+
+/* Waits for data, or until the segment is old enough to rotate */
+static void logging_wait(void)
+{
+    struct timespec deadline;
+    gint64 left;
+
+    if(log_rotate_age == 0 || log_segment_bytes == 0 || g_atomic_int_get(&log_errno) != 0)
+    {
+	pthread_cond_wait(&log_work, &log_lock);
+	return;
+    }
+
+    left = log_segment_opened + log_rotate_age - g_get_monotonic_time();
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += left / G_USEC_PER_SEC;
+    deadline.tv_nsec += (left % G_USEC_PER_SEC) * 1000;
+    if(deadline.tv_nsec >= 1000000000)
+    {
+	deadline.tv_sec++;
+	deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&log_work, &log_lock, &deadline);
+}
+
+static void logging_rotate_check(void)
+{
+    if(g_atomic_int_get(&log_errno) != 0)
+	return;
+
+    if((log_rotate_size != 0 && log_segment_bytes >= log_rotate_size) ||
+       (log_rotate_age != 0 && g_get_monotonic_time() - log_segment_opened >= log_rotate_age))
+	logging_rotate();
+}
+
+static void logging_text_flush(void)
+{
+    logging_write(log_text, log_text_used);
+    log_text_used = 0;
+}
+
+/* LOG_HEX_PER_LINE "%02X " per line */
+static void logging_format_hex(const guchar *data, gsize size)
+{
+    gsize length;
+
+    while(size > 0)
+    {
+	if(log_text_used + LOG_HEX_PER_LINE * 3 + 1 > LOG_TEXT_SIZE)
+	    logging_text_flush();
+
+	length = MIN(size, LOG_HEX_PER_LINE - log_hex_column);
+	log_text_used += hex_dump_bytes(data, length, log_text + log_text_used);
+	log_hex_column += length;
+	data += length;
+	size -= length;
+
+	if(log_hex_column == LOG_HEX_PER_LINE)
+	{
+	    log_text[log_text_used - 1] = '\n';
+	    log_hex_column = 0;
+	}
+    }
+}
+
+/* The text, each line starting with the arrival time of its first byte */
+static void logging_format_timestamp(gint64 time, const gchar *data, gsize size)
+{
+    gchar stamp[LOG_STAMP_SIZE];
+    gsize stamp_length = 0;
+    struct tm date;
+    time_t seconds;
+    gchar *end;
+    gsize length;
+
+    while(size > 0)
+    {
+	if(log_line_start)
+	{
+	    if(stamp_length == 0)
+	    {
+		seconds = time / G_USEC_PER_SEC;
+		localtime_r(&seconds, &date);
+		stamp_length = strftime(stamp, sizeof(stamp), "[%Y-%m-%d %H:%M:%S", &date);
+		stamp_length += g_snprintf(stamp + stamp_length, sizeof(stamp) - stamp_length,
+					   ".%03d] ", (gint)(time % G_USEC_PER_SEC / 1000));
+	    }
+	    if(log_text_used + stamp_length > LOG_TEXT_SIZE)
+		logging_text_flush();
+	    memcpy(log_text + log_text_used, stamp, stamp_length);
+	    log_text_used += stamp_length;
+	    log_line_start = FALSE;
+	}
+
+	end = memchr(data, '\n', size);
+	length = (end != NULL) ? (gsize)(end - data) + 1 : size;
+	if(log_text_used + length > LOG_TEXT_SIZE)
+	    logging_text_flush();
+	if(length > LOG_TEXT_SIZE)
+	    /* a line longer than the whole text buffer */
+	    logging_write(data, length);
+	else
+	{
+	    memcpy(log_text + log_text_used, data, length);
+	    log_text_used += length;
+	}
+	data += length;
+	size -= length;
+	log_line_start = (end != NULL);
+    }
+}
+
+static void logging_output(log_buffer_t *buffer)
+{
+    log_record_t record;
+    gsize position;
+
+    switch(log_session_format)
+    {
+	case LOG_FORMAT_HEX:
+	    logging_format_hex((guchar *)buffer->data, buffer->used);
+	    break;
+	case LOG_FORMAT_TIMESTAMP:
+	    for(position = 0; position < buffer->used; position += sizeof(record) + record.size)
+	    {
+		memcpy(&record, buffer->data + position, sizeof(record));
+		logging_format_timestamp(record.time, buffer->data + position + sizeof(record), record.size);
+	    }
+	    break;
+	default:
+	    logging_write(buffer->data, buffer->used);
+	    return;
+    }
+    logging_text_flush();
+}
+
+static void *logging_main(void *data)
+{
+    log_buffer_t *buffer;
+
+    pthread_mutex_lock(&log_lock);
+    while(1)
+    {
+	while(log_queued == 0 && log_quit == FALSE)
+	{
+	    if(logging_rotate_due())
+		logging_rotate();
+	    else
+		logging_wait();
+	}
+	if(log_queued == 0)
+	    break;
+	buffer = log_queue[log_queue_head];
+	pthread_mutex_unlock(&log_lock);
+
+	logging_output(buffer);
+	logging_rotate_check();
+
+	pthread_mutex_lock(&log_lock);
+	buffer->used = 0;
+	log_spare[log_spares++] = buffer;
+	log_queue_head = (log_queue_head + 1) % LOG_BUFFERS_MAX;
+	log_queued--;
+	pthread_cond_signal(&log_idle);
+
+	/* the reception had to wait : tell it now that there is room again */
+	if(g_atomic_int_compare_and_exchange(&log_behind, 1, 2))
+	{
+	    if(write(log_wakeup[1], "", 1) == -1)
+		perror("log wakeup");
+	}
+    }
+    pthread_mutex_unlock(&log_lock);
+
+    return NULL;
+}
+
+/* Gives the current buffer to the writer thread */
+static void logging_hand_over(void)
+{
+    if(callback_handler_flush != 0)
+    {
+	g_source_remove(callback_handler_flush);
+	callback_handler_flush = 0;
+    }
+
+    if(log_current == NULL)
+	return;
+    if(log_current->used == 0)
+	return;
+
+    pthread_mutex_lock(&log_lock);
+    log_queue[(log_queue_head + log_queued) % LOG_BUFFERS_MAX] = log_current;
+    log_queued++;
+    pthread_cond_signal(&log_work);
+    pthread_mutex_unlock(&log_lock);
+
+    log_current = NULL;
+}
+
+/* Gets an empty buffer : a spare one, a new one while the backlog is
+   under LOG_BUFFERS_MAX, else the first one the writer thread is done
+   with */
+static log_buffer_t *logging_take(void)
+{
+    log_buffer_t *buffer;
+
+    pthread_mutex_lock(&log_lock);
+    if(log_spares == 0 && log_allocated < LOG_BUFFERS_MAX)
+    {
+	buffer = &log_buffers[log_allocated++];
+	if(buffer->data == NULL)
+	    buffer->data = g_malloc(LOG_BUFFER_SIZE);
+	buffer->used = 0;
+	log_spare[log_spares++] = buffer;
+    }
+    if(log_spares == 0)
+    {
+	log_waits++;
+	g_atomic_int_compare_and_exchange(&log_behind, 0, 1);
+	while(log_spares == 0)
+	    pthread_cond_wait(&log_idle, &log_lock);
+    }
+    buffer = log_spare[--log_spares];
+    pthread_mutex_unlock(&log_lock);
+
+    return buffer;
+}
+
+/* Hands over what is buffered and waits until it is on the disk */
+static void logging_sync(void)
+{
+    logging_hand_over();
+
+    pthread_mutex_lock(&log_lock);
+    while(log_queued != 0)
+	pthread_cond_wait(&log_idle, &log_lock);
+    pthread_mutex_unlock(&log_lock);
+}
+
+static gboolean logging_timeout(gpointer data)
+{
+    callback_handler_flush = 0;
+    logging_hand_over();
+
+    return FALSE;
+}
+
+static gboolean logging_report(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    gchar dummy[64];
+    gchar *str;
+    gint error;
+
+    while(read(log_wakeup[0], dummy, sizeof(dummy)) > 0)
+	;
+
+    if(g_atomic_int_compare_and_exchange(&log_behind, 2, 0))
+    {
+	str = g_strdup_printf(_("The reception waited %llu times for the log : the disk is too slow"),
+			      (unsigned long long)log_waits);
+	if(Fenetre == NULL)
+	    i18n_fprintf(stderr, "%s\n", str);
+	else
+	    Put_temp_message(str, 5000);
+	g_free(str);
+	log_waits = 0;
+    }
+
+    error = g_atomic_int_get(&log_errno);
+    if(error != 0)
+    {
+	str = g_strdup_printf(_("Failed to log data to %s: %s\nLogging stopped\n"), LoggingFileName, strerror(error));
+	/* this watch is removed by returning FALSE */
+	callback_handler_log = 0;
+	logging_stop();
+	show_message(str, MSG_ERR);
+	g_free(str);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean logging_begin(void)
+{
+    GIOChannel *channel;
+    struct stat status;
+    gint i;
+
+    if(pipe(log_wakeup) == -1)
+	return FALSE;
+    fcntl(log_wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(log_wakeup[1], F_SETFL, O_NONBLOCK);
+
+    for(i = 0; i < LOG_BUFFERS; i++)
+    {
+	if(log_buffers[i].data == NULL)
+	    log_buffers[i].data = g_malloc(LOG_BUFFER_SIZE);
+	log_buffers[i].used = 0;
+	log_spare[i] = &log_buffers[i];
+    }
+    log_allocated = LOG_BUFFERS;
+    log_spares = LOG_BUFFERS;
+    log_current = NULL;
+    log_queue_head = 0;
+    log_queued = 0;
+    log_quit = FALSE;
+    log_waits = 0;
+    log_session_format = log_format;
+    log_text_used = 0;
+    log_hex_column = 0;
+    log_line_start = TRUE;
+    if(fstat(log_fd, &status) == 0)
+	log_segment_bytes = status.st_size;
+    else
+	log_segment_bytes = 0;
+    log_segment_opened = g_get_monotonic_time();
+    log_segment_start = g_get_real_time();
+    logging_index_read();
+    g_atomic_int_set(&log_errno, 0);
+    g_atomic_int_set(&log_behind, 0);
+
+    channel = g_io_channel_unix_new(log_wakeup[0]);
+    callback_handler_log = g_io_add_watch_full(channel,
+					       10,
+					       G_IO_IN,
+					       (GIOFunc)logging_report,
+					       NULL, NULL);
+    g_io_channel_unref(channel);
+
+    if(pthread_create(&log_thread, NULL, logging_main, NULL) != 0)
+    {
+	g_source_remove(callback_handler_log);
+	callback_handler_log = 0;
+	close(log_wakeup[0]);
+	close(log_wakeup[1]);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Writes what is left and stops the writer thread */
+static void logging_end(void)
+{
+    gint i;
+
+    logging_hand_over();
+
+    pthread_mutex_lock(&log_lock);
+    log_quit = TRUE;
+    pthread_cond_signal(&log_work);
+    pthread_mutex_unlock(&log_lock);
+    pthread_join(log_thread, NULL);
+    compress_end();
+
+    /* the backlog of a slow disk is not kept for the next session */
+    for(i = LOG_BUFFERS; i < log_allocated; i++)
+    {
+	g_free(log_buffers[i].data);
+	log_buffers[i].data = NULL;
+    }
+    log_allocated = 0;
+
+    if(callback_handler_log != 0)
+	g_source_remove(callback_handler_log);
+    callback_handler_log = 0;
+    close(log_wakeup[0]);
+    close(log_wakeup[1]);
+}
+
 static gint OpenLogFile(gchar *filename)
 {
     gchar *str;
@@ -53,24 +800,31 @@ static gint OpenLogFile(gchar *filename)
 	return FALSE;
     }
 
-    if(LoggingFile != NULL)
-    {
-	fclose(LoggingFile);
-	LoggingFile = NULL;
-	Logging = FALSE;
-    }
+    if(log_fd != -1)
+	logging_stop();
 
     LoggingFileName = filename;
 
-    LoggingFile = fopen(LoggingFileName, "a");
-    if(LoggingFile == NULL)
+    log_fd = open(LoggingFileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(log_fd == -1)
     {
 	str = g_strdup_printf(_("Cannot open file %s: %s\n"), LoggingFileName, strerror(errno));
 
 	show_message(str, MSG_ERR);
 	g_free(str);
 	g_free(LoggingFileName);
+	LoggingFileName = NULL;
+    } else if(logging_begin() == FALSE) {
+	str = g_strdup_printf(_("Cannot start the log writer: %s\n"), strerror(errno));
+
+	show_message(str, MSG_ERR);
+	g_free(str);
+	close(log_fd);
+	log_fd = -1;
+	g_free(LoggingFileName);
+	LoggingFileName = NULL;
     } else {
+	g_free(logfile_default);
 	logfile_default = g_strdup(LoggingFileName);
 	Logging = TRUE;
     }
@@ -78,10 +832,110 @@ static gint OpenLogFile(gchar *filename)
     return FALSE;
 }
 
+/* Used by the next log file */
+gboolean logging_set_format(const gchar *format)
+{
+    gint i;
+
+    for(i = 0; i < LOG_FORMATS; i++)
+    {
+	if(!g_ascii_strcasecmp(format, log_format_names[i]))
+	{
+	    log_format = i;
+	    return TRUE;
+	}
+    }
+
+    i18n_fprintf(stderr, _("Invalid log format: %s\nUse raw, hex or timestamp\n"), format);
+    return FALSE;
+}
+
+/* "size=<MB>,age=<minutes>,keep=<N>,gzip", for the next log file */
+gboolean logging_set_rotation(const gchar *options)
+{
+    gchar **tokens, *value;
+    gint i;
+    gboolean valid = TRUE;
+
+    tokens = g_strsplit(options, ",", -1);
+    for(i = 0; tokens[i] != NULL && valid == TRUE; i++)
+    {
+	value = strchr(tokens[i], '=');
+	if(value != NULL)
+	    *value++ = 0;
+
+	if(tokens[i][0] == 0)
+	    continue;
+	else if(!strcmp(tokens[i], "gzip") && value == NULL)
+	    log_rotate_gzip = TRUE;
+	else if(value == NULL || atoi(value) < 0)
+	    valid = FALSE;
+	else if(!strcmp(tokens[i], "size"))
+	    log_rotate_size = (guint64)atoi(value) * 1024 * 1024;
+	else if(!strcmp(tokens[i], "age"))
+	    log_rotate_age = (gint64)atoi(value) * 60 * G_USEC_PER_SEC;
+	else if(!strcmp(tokens[i], "keep"))
+	    log_rotate_keep = atoi(value);
+	else
+	    valid = FALSE;
+    }
+    g_strfreev(tokens);
+
+    if(valid == FALSE)
+	i18n_fprintf(stderr, _("Invalid log rotation: %s\n"
+			       "Use size=<MB>,age=<minutes>,keep=<N>,gzip\n"), options);
+
+    return valid;
+}
+
+/* "bytes=<N>" : a buffer goes to the disk once it holds N bytes,
+   "ms=<N>" : N ms at most after its first byte,
+   "line" : at the end of each chunk holding a new line.
+   In any case, a full buffer goes to the disk at once */
+gboolean logging_set_flush(const gchar *policy)
+{
+    gint value = 0;
+
+    if(!strcmp(policy, "line"))
+    {
+	log_flush_policy = LOG_FLUSH_LINE;
+	return TRUE;
+    }
+
+    if(sscanf(policy, "bytes=%d", &value) == 1 && value > 0 && value <= LOG_BUFFER_SIZE)
+    {
+	log_flush_policy = LOG_FLUSH_BYTES;
+	log_flush_value = value;
+	return TRUE;
+    }
+
+    if(sscanf(policy, "ms=%d", &value) == 1 && value > 0)
+    {
+	log_flush_policy = LOG_FLUSH_MS;
+	log_flush_value = value;
+	return TRUE;
+    }
+
+    i18n_fprintf(stderr, _("Invalid log flush policy: %s\n"
+			   "Use bytes=<1..%d>, ms=<N> or line\n"), policy, LOG_BUFFER_SIZE);
+    return FALSE;
+}
+
+/* Starts logging to the given file, without asking */
+gint logging_start_file(gchar *filename)
+{
+    OpenLogFile(g_strdup(filename));
+
+    toggle_logging_sensitivity(Logging);
+    toggle_logging_pause_resume(Logging);
+
+    return Logging;
+}
+
 gint logging_start(GtkWidget *widget)
 {
-    GtkWidget *file_select;
-    gint retval;
+    GtkWidget *file_select, *format_box, *Label, *Combo;
+    gint retval, i;
 
     file_select = gtk_file_chooser_dialog_new(_("Log file selection"), GTK_WINDOW(Fenetre),
 					      GTK_FILE_CHOOSER_ACTION_OPEN,
@@ -94,9 +948,24 @@ gint logging_start(GtkWidget *widget)
 	gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(file_select), logfile_default);
     }
 
+    format_box = gtk_hbox_new(FALSE, 5);
+    Label = gtk_label_new(_("Format:"));
+    gtk_box_pack_start(GTK_BOX(format_box), Label, FALSE, FALSE, 0);
+    Combo = gtk_combo_box_new_text();
+    gtk_combo_box_append_text(GTK_COMBO_BOX(Combo), _("Raw data"));
+    gtk_combo_box_append_text(GTK_COMBO_BOX(Combo), _("Hexadecimal text"));
+    gtk_combo_box_append_text(GTK_COMBO_BOX(Combo), _("Timestamped text"));
+    gtk_combo_box_set_active(GTK_COMBO_BOX(Combo), log_format);
+    gtk_box_pack_start(GTK_BOX(format_box), Combo, FALSE, FALSE, 0);
+    gtk_widget_show_all(format_box);
+    gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(file_select), format_box);
+
     retval = gtk_dialog_run(GTK_DIALOG(file_select));
     if(retval == GTK_RESPONSE_OK)
     {
+       i = gtk_combo_box_get_active(GTK_COMBO_BOX(Combo));
+       if(i >= 0)
+	   log_format = i;
        OpenLogFile(gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(file_select)));
     }
 
@@ -110,30 +979,38 @@ gint logging_start(GtkWidget *widget)
 
 void logging_clear(void)
 {
-   if(LoggingFile == NULL)
-   {
-      return;
-   }
+    gchar *str;
 
-   //Reopening with "w" will truncate the file
-   LoggingFile = freopen(LoggingFileName, "w", LoggingFile);
+    if(log_fd == -1)
+	return;
 
-   if (LoggingFile == NULL)
-   {
-      gchar *str = g_strdup_printf(_("Cannot open file %s: %s\n"), LoggingFileName, strerror(errno));
-      show_message(str, MSG_ERR);
-      g_free(str);
-      g_free(LoggingFileName);
-   }
+    /* what is buffered belongs to the old content */
+    logging_sync();
+    if(ftruncate(log_fd, 0) == -1)
+    {
+	str = g_strdup_printf(_("Cannot clear file %s: %s\n"), LoggingFileName, strerror(errno));
+	show_message(str, MSG_ERR);
+	g_free(str);
+	return;
+    }
+
+    /* the writer thread waits for data */
+    pthread_mutex_lock(&log_lock);
+    log_offset += log_segment_bytes;
+    log_segment_bytes = 0;
+    log_segment_opened = g_get_monotonic_time();
+    log_segment_start = g_get_real_time();
+    pthread_mutex_unlock(&log_lock);
 }
 
 void logging_pause_resume(void)
 {
-    if(LoggingFile == NULL) {
+    if(log_fd == -1) {
 	return;
     }
     if(Logging == TRUE) {
 	Logging = FALSE;
+	logging_hand_over();
     } else {
 	Logging = TRUE;
     }
@@ -142,12 +1019,21 @@ void logging_pause_resume(void)
 
 void logging_stop(void)
 {
-    if(LoggingFile == NULL) {
+    gchar *str;
+
+    if(log_fd == -1) {
 	return;
     }
 
-    fclose(LoggingFile);
-    LoggingFile = NULL;
+    logging_end();
+    /* a network file system may only report the errors now */
+    if(close(log_fd) == -1 && g_atomic_int_get(&log_errno) == 0)
+    {
+	str = g_strdup_printf(_("Failed to log data to %s: %s\n"), LoggingFileName, strerror(errno));
+	show_message(str, MSG_ERR);
+	g_free(str);
+    }
+    log_fd = -1;
     Logging = FALSE;
     g_free(LoggingFileName);
     LoggingFileName = NULL;
@@ -156,29 +1042,65 @@ void logging_stop(void)
     toggle_logging_pause_resume(Logging);
 }
 
+/* Called from the receive path : only copies the data */
 void log_chars(gchar *chars, guint size)
 {
-   guint writeAttempts = 0;
-   guint bytesWritten = 0;
+    gboolean new_line;
+    gsize length, header;
+    log_record_t record;
 
     /* if we are not logging exit */
-    if(LoggingFile == NULL || Logging == FALSE) {
-    	return;
+    if(log_fd == -1 || Logging == FALSE) {
+	return;
     }
 
-    while (bytesWritten < size)
+    new_line = (log_flush_policy == LOG_FLUSH_LINE && memchr(chars, '\n', size) != NULL);
+    header = (log_session_format == LOG_FORMAT_TIMESTAMP) ? sizeof(record) : 0;
+    record.time = g_get_real_time();
+
+    while(size > 0)
     {
-       if (writeAttempts < MAX_WRITE_ATTEMPTS)
-       {
-          bytesWritten += fwrite(&chars[bytesWritten], 1,
-                                 size-bytesWritten, LoggingFile);
-       }
-       else
-       {
-           show_message(_("Failed to log data\n"), MSG_ERR);
-          return;
-       }
+	if(log_current == NULL)
+	    log_current = logging_take();
+
+	if(LOG_BUFFER_SIZE - log_current->used <= header)
+	{
+	    logging_hand_over();
+	    continue;
+	}
+
+	length = MIN(size, LOG_BUFFER_SIZE - log_current->used - header);
+	if(header != 0)
+	{
+	    record.size = length;
+	    memcpy(log_current->data + log_current->used, &record, header);
+	    log_current->used += header;
+	}
+	memcpy(log_current->data + log_current->used, chars, length);
+	log_current->used += length;
+	chars += length;
+	size -= length;
+
+	if(log_current->used == LOG_BUFFER_SIZE)
+	    logging_hand_over();
     }
 
-    fflush(LoggingFile);
+    if(log_current == NULL)
+	return;
+
+    switch(log_flush_policy)
+    {
+	case LOG_FLUSH_LINE:
+	    if(new_line)
+		logging_hand_over();
+	    break;
+	case LOG_FLUSH_BYTES:
+	    if(log_current->used >= log_flush_value)
+		logging_hand_over();
+	    break;
+	default:
+	    if(callback_handler_flush == 0)
+		callback_handler_flush = g_timeout_add(log_flush_value, logging_timeout, NULL);
+	    break;
+    }
 }
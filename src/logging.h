@@ -14,10 +14,34 @@
 #ifndef LOGGING_H_
 #define LOGGING_H_
 
+#define LOG_BUFFERS 3                 /* handed in turn to the writer thread */
+#define LOG_BUFFER_SIZE (256 * 1024)
+#define LOG_BUFFERS_MAX 64            /* the writer backlog, 16 MB : beyond, the reception waits */
+#define LOG_FLUSH_DEFAULT_MS 100
+
+#define LOG_FLUSH_BYTES 0
+#define LOG_FLUSH_MS 1
+#define LOG_FLUSH_LINE 2
+
+#define LOG_FORMAT_RAW 0              /* the received bytes */
+#define LOG_FORMAT_HEX 1              /* "%02X " text, LOG_HEX_PER_LINE per line */
+#define LOG_FORMAT_TIMESTAMP 2        /* text lines after their arrival time */
+#define LOG_FORMATS 3
+#define LOG_HEX_PER_LINE 16
+#define LOG_TEXT_SIZE (64 * 1024)     /* formatting buffer of the writer thread */
+#define LOG_STAMP_SIZE 64
+#define LOG_INDEX_LINE 4096
+#define LOG_ROTATE_KEEP 10            /* rotated segments kept, 0 : all */
+#define LOG_COMPRESS_NICE 19
+
 gint logging_start(GtkWidget *);
+gint logging_start_file(gchar *);
 void logging_pause_resume(void);
 void logging_stop(void);
 void logging_clear(void);
 void log_chars(gchar *chars, guint size);
+gboolean logging_set_flush(const gchar *);
+gboolean logging_set_format(const gchar *);
+gboolean logging_set_rotation(const gchar *);
 
 #endif /* LOGGING_H_ */
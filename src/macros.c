@@ -52,7 +52,9 @@ macro_t *get_shortcuts(gint *size)
 }
 
 
-static void shortcut_callback(gpointer *number)
+/* Translates the escape sequences of the action into the bytes to
+   send, once, when the macros are loaded or edited */
+static void macro_compile(macro_t *macro)
 {
   gchar *string;
   gchar *str;
@@ -60,8 +62,10 @@ static void shortcut_callback(gpointer *number)
   guchar a;
   guint val_read;
 
-  string = macros[(long)number].action;
-  length = strlen(string);
+  string = macro->action;
+  length = (string != NULL) ? strlen(string) : 0;
+  macro->data = g_malloc(length + 1);
+  macro->length = 0;
 
   for(i = 0; i < length; i++)
     {
@@ -133,27 +137,41 @@ static void shortcut_callback(gpointer *number)
 		}
 	      i++;
 	    }
-	  send_serial((gchar*)&a, 1);
+	  macro->data[macro->length++] = a;
 	}
       else
-	{
-	  send_serial(&string[i], 1);
-	}
+	macro->data[macro->length++] = string[i];
     }
+  macro->data[macro->length] = 0;
+}
+
+static void shortcut_callback(gpointer *number)
+{
+  macro_t *macro;
+  gchar *str;
+
+  macro = &macros[(long)number];
 
-  str = g_strdup_printf(_("Macro \"%s\" sent !"), macros[(long)number].shortcut);
+  /* the whole macro in one go, the rest follows if the queue is full */
+  send_serial_all(macro->data, macro->length);
+
+  str = g_strdup_printf(_("Macro \"%s\" sent !"), macro->shortcut);
   Put_temp_message(str, 800);
   g_free(str);
 }
 
 void create_shortcuts(macro_t *macro, gint size)
 {
+  gint i;
+
   macros = g_malloc((size + 1) * sizeof(macro_t));
   if(macros != NULL)
     {
       memcpy(macros, macro, size * sizeof(macro_t));
       macros[size].shortcut = NULL;
       macros[size].action = NULL;
+      for(i = 0; i < size; i++)
+	macro_compile(&macros[i]);
     }
   else
     perror("malloc");
@@ -189,6 +207,7 @@ static void macros_destroy(void)
     {
       g_free(macros[i].shortcut);
       g_free(macros[i].action);
+      g_free(macros[i].data);
       /*
       g_closure_unref(macros[i].closure);
       */
@@ -205,7 +224,8 @@ void remove_shortcuts(void)
   if(macros == NULL)
     return;
 
-  while(macros[i].shortcut != NULL)
+  /* no window : the shortcuts have never been connected */
+  while(shortcuts != NULL && macros[i].shortcut != NULL)
     {
       gtk_accel_group_disconnect(shortcuts, macros[i].closure);
       i++;
@@ -348,6 +368,7 @@ static gboolean Save_shortcuts(GtkWidget *button, gpointer pointer)
 	      gtk_tree_model_get(model, &iter, COLUMN_SHORTCUT, &(macros[i].shortcut), \
 				 COLUMN_ACTION, &(macros[i].action), \
 				 -1);
+	      macro_compile(&macros[i]);
 	      i++;
 	    } while(gtk_tree_model_iter_next(model, &iter));
 
@@ -20,6 +20,8 @@ typedef struct
   gchar *shortcut;
   gchar *action;
   GClosure *closure;
+  gchar *data;                 /* action with the escapes translated */
+  gsize length;
 }
 macro_t;
 
@@ -0,0 +1,276 @@
+/***********************************************************************/
+/* prbs.c                                                              */
+/* ------                                                              */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Pseudo random bit sequences (PRBS-7/15/23/31) :                */
+/*      generator and self synchronising checker, for the bit          */
+/*      error rate tests. The LFSR gives 'tap' bits per step and       */
+/*      the checker compares 64 bits at a time                         */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+#include <string.h>
+
+#include "prbs.h"
+#include "i18n.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+/* ITU-T O.150 polynomials */
+static const gint prbs_taps[][2] =
+{
+    {7, 6},
+    {15, 14},
+    {23, 18},
+    {31, 28}
+};
+
+gboolean prbs_init(prbs_t *prbs, gint order)
+{
+    guint i;
+
+    for(i = 0; i < G_N_ELEMENTS(prbs_taps); i++)
+    {
+	if(prbs_taps[i][0] == order)
+	{
+	    prbs->order = order;
+	    prbs->tap = prbs_taps[i][1];
+	    prbs->state = (1U << order) - 1;
+	    prbs->spare = 0;
+	    prbs->spare_bits = 0;
+	    return TRUE;
+	}
+    }
+
+    return FALSE;
+}
+
+/* b[i] = b[i - order] ^ b[i - tap] : the next 'tap' bits only depend
+   on bits already in the register, so they are computed together */
+static inline guint32 prbs_step(prbs_t *prbs)
+{
+    guint32 bits;
+
+    bits = (prbs->state ^ (prbs->state >> (prbs->order - prbs->tap))) & ((1U << prbs->tap) - 1);
+    prbs->state = (prbs->state >> prbs->tap) | (bits << (prbs->order - prbs->tap));
+
+    return bits;
+}
+
+/* Next 'count' bits (up to 32) of the sequence, the first one in bit 0 */
+static inline guint32 prbs_bits(prbs_t *prbs, gint count)
+{
+    guint32 bits;
+
+    while(prbs->spare_bits < count)
+    {
+	prbs->spare |= (guint64)prbs_step(prbs) << prbs->spare_bits;
+	prbs->spare_bits += prbs->tap;
+    }
+    bits = prbs->spare & (((guint64)1 << count) - 1);
+    prbs->spare >>= count;
+    prbs->spare_bits -= count;
+
+    return bits;
+}
+
+static inline guint64 prbs_word(prbs_t *prbs)
+{
+    guint64 word;
+
+    word = prbs_bits(prbs, 32);
+    return word | (guint64)prbs_bits(prbs, 32) << 32;
+}
+
+/* The bits go out LSB first, as on the line */
+void prbs_generate(prbs_t *prbs, guint8 *out, gsize size)
+{
+    guint32 bits;
+
+    for(; size >= 4; size -= 4, out += 4)
+    {
+	bits = GUINT32_TO_LE(prbs_bits(prbs, 32));
+	memcpy(out, &bits, 4);
+    }
+    for(; size > 0; size--)
+	*out++ = prbs_bits(prbs, 8);
+}
+
+gboolean prbs_check_init(prbs_check_t *check, gint order)
+{
+    memset(check, 0, sizeof(prbs_check_t));
+
+    return prbs_init(&check->expected, order);
+}
+
+/* Two generators are at the same place if they give the same next bits */
+static gboolean prbs_same(prbs_t *first, prbs_t *second)
+{
+    prbs_t a = *first, b = *second;
+
+    return prbs_word(&a) == prbs_word(&b);
+}
+
+/* How many bytes 'ahead' is in advance of 'behind', 0 if not found */
+static gint prbs_slip(prbs_t *behind, prbs_t *ahead)
+{
+    prbs_t moving = *behind;
+    gint bytes;
+
+    for(bytes = 1; bytes <= PRBS_MAX_SLIP; bytes++)
+    {
+	prbs_bits(&moving, 8);
+	if(prbs_same(&moving, ahead))
+	    return bytes;
+    }
+
+    return 0;
+}
+
+/* The register is loaded from the last bits of the seed bytes, then
+   the next bytes must match exactly. A zero state would match an idle
+   line */
+static gboolean prbs_hunt(prbs_check_t *check, prbs_t *found)
+{
+    guint32 seed = 0;
+    gint i, seed_bytes;
+
+    seed_bytes = (check->expected.order + 7) / 8;
+    for(i = 0; i < seed_bytes; i++)
+	seed |= (guint32)check->hunt[i] << (8 * i);
+
+    *found = check->expected;
+    found->state = (seed >> (8 * seed_bytes - found->order)) & ((1U << found->order) - 1);
+    found->spare = 0;
+    found->spare_bits = 0;
+    if(found->state == 0)
+	return FALSE;
+
+    for(i = seed_bytes; i < check->hunt_length; i++)
+    {
+	if(prbs_bits(found, 8) != check->hunt[i])
+	    return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void prbs_hunt_byte(prbs_check_t *check, guint8 byte)
+{
+    prbs_t found;
+    gint bytes;
+
+    /* keep the old position to measure the slip */
+    if(check->ever_locked)
+	prbs_bits(&check->expected, 8);
+
+    check->hunt[check->hunt_length++] = byte;
+    if(check->hunt_length < (check->expected.order + 7) / 8 + PRBS_VERIFY)
+	return;
+
+    if(prbs_hunt(check, &found) == FALSE)
+    {
+	memmove(check->hunt, check->hunt + 1, --check->hunt_length);
+	return;
+    }
+
+    if(check->ever_locked)
+    {
+	check->resyncs++;
+	if((bytes = prbs_slip(&check->expected, &found)) != 0)
+	    check->lost += bytes;
+	else if((bytes = prbs_slip(&found, &check->expected)) != 0)
+	    check->inserted += bytes;
+    }
+    check->expected = found;
+    check->locked = TRUE;
+    check->ever_locked = TRUE;
+    check->hunt_length = 0;
+    check->window_bytes = 0;
+    check->window_errors = 0;
+}
+
+/* The errors of a window only count if the sync is still there at the
+   end of the next one : a slip is not a burst of bit errors, and it may
+   fall at the end of a window */
+static inline void prbs_check_word(prbs_check_t *check, guint64 received)
+{
+    check->window_errors += __builtin_popcountll(GUINT64_FROM_LE(received) ^ prbs_word(&check->expected));
+    check->window_bytes += 8;
+    if(check->window_bytes < PRBS_WINDOW)
+	return;
+
+    if(check->window_errors > PRBS_LOSS)
+    {
+	check->locked = FALSE;
+	check->previous_bytes = 0;
+	check->previous_errors = 0;
+    }
+    else
+    {
+	check->bytes += check->previous_bytes;
+	check->errors += check->previous_errors;
+	check->previous_bytes = check->window_bytes;
+	check->previous_errors = check->window_errors;
+    }
+    check->window_bytes = 0;
+    check->window_errors = 0;
+}
+
+void prbs_check(prbs_check_t *check, const guint8 *data, gsize size)
+{
+    guint64 word;
+
+    while(size > 0)
+    {
+	if(check->locked == FALSE)
+	{
+	    prbs_hunt_byte(check, *data++);
+	    size--;
+	}
+	else if(check->word_length == 0 && size >= 8)
+	{
+	    memcpy(&word, data, 8);
+	    prbs_check_word(check, word);
+	    data += 8;
+	    size -= 8;
+	}
+	else
+	{
+	    check->word[check->word_length++] = *data++;
+	    size--;
+	    if(check->word_length == 8)
+	    {
+		memcpy(&word, check->word, 8);
+		prbs_check_word(check, word);
+		check->word_length = 0;
+	    }
+	}
+    }
+}
+
+gchar *prbs_check_stats(prbs_check_t *check)
+{
+    guint64 bytes, errors;
+    gdouble ber = 0;
+
+    bytes = check->bytes + check->previous_bytes;
+    errors = check->errors + check->previous_errors;
+    if(bytes != 0)
+	ber = (gdouble)errors / (bytes * 8);
+
+    return g_strdup_printf(_("PRBS-%d check: %s, %" G_GUINT64_FORMAT " bits, %" G_GUINT64_FORMAT
+			     " bit errors (BER %.2e), %" G_GUINT64_FORMAT " bytes lost, %"
+			     G_GUINT64_FORMAT " bytes inserted, %u resyncs"),
+			   check->expected.order,
+			   check->locked ? _("in sync") : _("no sync"),
+			   bytes * 8, errors, ber,
+			   check->lost, check->inserted, check->resyncs);
+}
@@ -0,0 +1,63 @@
+/***********************************************************************/
+/* prbs.h                                                              */
+/* ------                                                              */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Pseudo random bit sequences (PRBS-7/15/23/31) :                */
+/*      generator and self synchronising checker                       */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef PRBS_H_
+#define PRBS_H_
+
+#include <glib.h>
+
+#define PRBS_SEED 4             /* bytes giving the state of a PRBS-31 */
+#define PRBS_VERIFY 8           /* bytes which must match to get the sync */
+#define PRBS_WINDOW 64          /* bytes checked before the errors count */
+#define PRBS_LOSS 128           /* bit errors in a window : sync lost */
+#define PRBS_MAX_SLIP 64        /* lost or inserted bytes searched for */
+
+/* x^order + x^tap + 1 */
+typedef struct
+{
+    gint order;
+    gint tap;
+    guint32 state;              /* last 'order' bits, the oldest in bit 0 */
+    guint64 spare;              /* bits generated, not given out yet */
+    gint spare_bits;
+} prbs_t;
+
+typedef struct
+{
+    prbs_t expected;
+    gboolean locked;
+    gboolean ever_locked;
+    guint8 hunt[PRBS_SEED + PRBS_VERIFY];
+    gint hunt_length;
+    guint8 word[8];
+    gint word_length;
+    guint window_bytes;
+    guint window_errors;
+    guint previous_bytes;       /* last window, counted after the next one */
+    guint previous_errors;
+    guint64 bytes;              /* checked while in sync */
+    guint64 errors;             /* bit errors */
+    guint64 lost;               /* bytes */
+    guint64 inserted;           /* bytes */
+    guint resyncs;
+} prbs_check_t;
+
+gboolean prbs_init(prbs_t *, gint);
+void prbs_generate(prbs_t *, guint8 *, gsize);
+gboolean prbs_check_init(prbs_check_t *, gint);
+void prbs_check(prbs_check_t *, const guint8 *, gsize);
+gchar *prbs_check_stats(prbs_check_t *);
+
+#endif
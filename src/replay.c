@@ -0,0 +1,356 @@
+/***********************************************************************/
+/* replay.c                                                            */
+/* --------                                                            */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Replay of a GTKTerm capture (the received records, at          */
+/*      their recorded time) or of a raw file (at the line rate        */
+/*      of the port) through put_chars(), like data read from          */
+/*      the port. The file is mapped and handed over in the            */
+/*      chunks the port delivered                                      */
+/*                                                                     */
+/***********************************************************************/
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+
+#include "widgets.h"
+#include "serie.h"
+#include "buffer.h"
+#include "capture.h"
+#include "replay.h"
+#include "i18n.h"
+
+#include <config.h>
+#include <glib/gi18n.h>
+
+typedef struct
+{
+    gchar *data;
+    gsize size;
+    gint64 time;                /* us since the start of the file */
+} replay_chunk_t;
+
+static gchar *replay_file = NULL;
+static gdouble replay_speed = 1.0;          /* 0 : as fast as possible */
+static gchar *replay_map = NULL;
+static gsize replay_size;
+static gsize replay_offset;
+static gsize replay_piece;                  /* already replayed in the record */
+static gboolean replay_native;
+static gsize replay_chunk;
+static guint replay_line_rate;
+static gint64 replay_origin;
+static gint64 replay_begin;
+static gint64 replay_cpu;
+static guint64 replay_bytes;
+static guint replay_chunks;
+static void (*replay_done)(void) = NULL;
+static guint callback_handler_replay = 0;
+
+static gboolean replay_step(gpointer data);
+
+static gint64 thread_cpu_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static void replay_message(const gchar *str, gboolean error)
+{
+    if(Fenetre == NULL)
+	i18n_fprintf(stderr, "%s\n", str);
+    else if(error)
+	show_message((gchar *)str, MSG_ERR);
+    else
+	Put_temp_message(str, 10000);
+}
+
+void replay_set_file(const gchar *file)
+{
+    g_free(replay_file);
+    replay_file = g_strdup(file);
+}
+
+/* <factor> (1 : the original timing) or max */
+gboolean replay_set_speed(const gchar *option)
+{
+    gchar *end;
+
+    if(!strcmp(option, "max"))
+    {
+	replay_speed = 0;
+	return TRUE;
+    }
+
+    replay_speed = g_ascii_strtod(option, &end);
+    if(*end != 0 || !(replay_speed > 0))
+    {
+	i18n_fprintf(stderr, _("Invalid replay speed : %s\n"), option);
+	replay_speed = 1.0;
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean replay_requested(void)
+{
+    return replay_file != NULL;
+}
+
+/* The chunk at replay_offset, FALSE at the end of the file. In a
+   capture, the sent records are skipped and the received ones are
+   cut to what a read of the port returns at most */
+static gboolean replay_next(replay_chunk_t *chunk)
+{
+    guint64 time;
+    guint32 size;
+
+    if(!replay_native)
+    {
+	if(replay_offset >= replay_size)
+	    return FALSE;
+	chunk->data = replay_map + replay_offset;
+	chunk->size = MIN(replay_size - replay_offset, replay_chunk);
+	chunk->time = replay_line_rate == 0 ? 0 :
+	    (gint64)((gdouble)replay_offset * G_USEC_PER_SEC / replay_line_rate);
+	return TRUE;
+    }
+
+    while(replay_offset + CAPTURE_RECORD_SIZE <= replay_size)
+    {
+	memcpy(&time, replay_map + replay_offset, 8);
+	memcpy(&size, replay_map + replay_offset + 12, 4);
+	time = GUINT64_FROM_LE(time);
+	size = GUINT32_FROM_LE(size);
+
+	/* truncated record : the capture was not stopped properly */
+	if(size > replay_size - replay_offset - CAPTURE_RECORD_SIZE)
+	    return FALSE;
+
+	if(replay_map[replay_offset + 8] != CAPTURE_RX || size == 0)
+	{
+	    replay_offset += CAPTURE_RECORD_SIZE + size;
+	    continue;
+	}
+
+	chunk->data = replay_map + replay_offset + CAPTURE_RECORD_SIZE + replay_piece;
+	chunk->size = MIN(size - replay_piece, BUFFER_RECEPTION);
+	chunk->time = (gint64)time;
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void replay_consume(gsize size)
+{
+    guint32 record;
+
+    if(!replay_native)
+    {
+	replay_offset += size;
+	return;
+    }
+
+    memcpy(&record, replay_map + replay_offset + 12, 4);
+    record = GUINT32_FROM_LE(record);
+    replay_piece += size;
+    if(replay_piece == record)
+    {
+	replay_offset += CAPTURE_RECORD_SIZE + record;
+	replay_piece = 0;
+    }
+}
+
+/* Idle when the chunk is already due, so that the window is still
+   drawn while a file is replayed as fast as possible */
+static void replay_arm(gint64 delay)
+{
+    if(delay <= 0)
+	callback_handler_replay = g_idle_add(replay_step, NULL);
+    else
+	callback_handler_replay = g_timeout_add(MAX((delay + 999) / 1000, 1), replay_step, NULL);
+}
+
+static void replay_end(void)
+{
+    gint64 elapsed, cpu;
+    gchar *str;
+
+    elapsed = g_get_monotonic_time() - replay_begin;
+    cpu = thread_cpu_usec() - replay_cpu;
+
+    if(replay_speed == 0)
+	str = g_strdup_printf(_("Replay of %s : %llu bytes in %u chunks, %.1f ms (%.1f MB/s), %.1f ms of CPU"),
+			      replay_file, (unsigned long long)replay_bytes, replay_chunks,
+			      (gdouble)elapsed / 1000,
+			      elapsed == 0 ? 0 : (gdouble)replay_bytes / elapsed * G_USEC_PER_SEC / (1024 * 1024),
+			      (gdouble)cpu / 1000);
+    else
+	str = g_strdup_printf(_("Replay of %s : %llu bytes in %u chunks, %.1f s"),
+			      replay_file, (unsigned long long)replay_bytes, replay_chunks,
+			      (gdouble)elapsed / G_USEC_PER_SEC);
+    replay_message(str, FALSE);
+    g_free(str);
+
+    replay_stop();
+    if(replay_done != NULL)
+	replay_done();
+}
+
+static gboolean replay_step(gpointer data)
+{
+    replay_chunk_t chunk;
+    gsize delivered = 0;
+    gint64 now, due;
+
+    callback_handler_replay = 0;
+    now = g_get_monotonic_time();
+
+    while(replay_next(&chunk))
+    {
+	if(replay_origin == -1)
+	    replay_origin = chunk.time;
+	if(replay_speed != 0)
+	{
+	    due = replay_begin + (gint64)((chunk.time - replay_origin) / replay_speed);
+	    if(due > now)
+	    {
+		replay_arm(due - now);
+		return FALSE;
+	    }
+	}
+	if(delivered >= REPLAY_DRAIN_MAX)
+	{
+	    replay_arm(0);
+	    return FALSE;
+	}
+
+	put_chars(chunk.data, chunk.size);
+	replay_consume(chunk.size);
+	delivered += chunk.size;
+	replay_bytes += chunk.size;
+	replay_chunks++;
+    }
+
+    replay_end();
+    return FALSE;
+}
+
+/* 'done' is called at the end of the file */
+gboolean replay_start(void (*done)(void))
+{
+    struct stat file_stat;
+    guint32 version;
+    gchar *str;
+    int fd;
+
+    if(replay_file == NULL)
+	return FALSE;
+
+    fd = open(replay_file, O_RDONLY);
+    if(fd == -1 || fstat(fd, &file_stat) == -1)
+    {
+	str = g_strdup_printf(_("Cannot read file %s: %s"), replay_file, strerror(errno));
+	replay_message(str, TRUE);
+	g_free(str);
+	if(fd != -1)
+	    close(fd);
+	return FALSE;
+    }
+
+    replay_size = file_stat.st_size;
+    replay_map = NULL;
+    if(replay_size != 0)
+    {
+	replay_map = mmap(NULL, replay_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(replay_map == MAP_FAILED)
+	{
+	    replay_map = NULL;
+	    str = g_strdup_printf(_("Cannot read file %s: %s"), replay_file, strerror(errno));
+	    replay_message(str, TRUE);
+	    g_free(str);
+	    close(fd);
+	    return FALSE;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(replay_map, replay_size, MADV_SEQUENTIAL);
+#endif
+    }
+    close(fd);
+
+    /* a pcapng capture would be taken for raw data */
+    if(replay_size >= 4 && !memcmp(replay_map, "\x0a\x0d\x0d\x0a", 4))
+    {
+	str = g_strdup_printf(_("%s : pcapng captures cannot be replayed"), replay_file);
+	replay_message(str, TRUE);
+	g_free(str);
+	replay_stop();
+	return FALSE;
+    }
+
+    /* a GTKTerm capture, or else raw data */
+    replay_native = replay_size >= CAPTURE_HEADER_SIZE &&
+	!memcmp(replay_map, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC));
+    replay_offset = 0;
+    replay_piece = 0;
+    if(replay_native)
+    {
+	memcpy(&version, replay_map + 8, 4);
+	if(GUINT32_FROM_LE(version) != CAPTURE_VERSION)
+	{
+	    str = g_strdup_printf(_("%s : unknown capture version %u"), replay_file, GUINT32_FROM_LE(version));
+	    replay_message(str, TRUE);
+	    g_free(str);
+	    replay_stop();
+	    return FALSE;
+	}
+	replay_offset = CAPTURE_HEADER_SIZE;
+    }
+
+    /* raw data comes as the port would give it : what the line carries
+       in REPLAY_RAW_TICK, or the biggest reads at maximum speed */
+    replay_line_rate = get_line_rate();
+    if(replay_speed == 0)
+	replay_chunk = BUFFER_RECEPTION;
+    else
+	replay_chunk = CLAMP((gsize)replay_line_rate * REPLAY_RAW_TICK / 1000, 1, BUFFER_RECEPTION);
+
+    replay_origin = -1;
+    replay_bytes = 0;
+    replay_chunks = 0;
+    replay_done = done;
+    replay_begin = g_get_monotonic_time();
+    replay_cpu = thread_cpu_usec();
+    replay_arm(0);
+
+    return TRUE;
+}
+
+void replay_stop(void)
+{
+    if(callback_handler_replay != 0)
+	g_source_remove(callback_handler_replay);
+    callback_handler_replay = 0;
+
+    if(replay_map != NULL)
+	munmap(replay_map, replay_size);
+    replay_map = NULL;
+}
@@ -0,0 +1,31 @@
+/***********************************************************************/
+/* replay.h                                                            */
+/* --------                                                            */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Replay of a capture or of a raw file through the               */
+/*      reception path, at the original timing, scaled, or             */
+/*      as fast as possible                                            */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <glib.h>
+
+#define REPLAY_DRAIN_MAX (64 * 1024)   /* max bytes handled per callback */
+#define REPLAY_RAW_TICK 10             /* in ms : raw file chunk at the line rate */
+
+void replay_set_file(const gchar *);
+gboolean replay_set_speed(const gchar *);
+gboolean replay_requested(void);
+gboolean replay_start(void (*done)(void));
+void replay_stop(void);
+
+#endif
@@ -0,0 +1,111 @@
+/***********************************************************************/
+/* ring.c                                                              */
+/* ------                                                              */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Lock-free single producer / single consumer byte ring          */
+/*                                                                     */
+/***********************************************************************/
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+gboolean ring_init(ring_t *ring, guint size)
+{
+    guint real_size = 1;
+
+    /* round up to the next power of two */
+    while(real_size < size)
+	real_size <<= 1;
+
+    ring->data = g_malloc(real_size);
+    if(ring->data == NULL)
+	return FALSE;
+
+    ring->size = real_size;
+    ring_reset(ring);
+
+    return TRUE;
+}
+
+void ring_free(ring_t *ring)
+{
+    g_free(ring->data);
+    ring->data = NULL;
+    ring->size = 0;
+}
+
+/* Only call this when neither the producer nor the consumer is running */
+void ring_reset(ring_t *ring)
+{
+    g_atomic_int_set(&ring->head, 0);
+    g_atomic_int_set(&ring->tail, 0);
+    ring->bytes_in = 0;
+    ring->max_fill = 0;
+    ring->full_count = 0;
+}
+
+guint ring_fill(ring_t *ring)
+{
+    return (guint)g_atomic_int_get(&ring->head) - (guint)g_atomic_int_get(&ring->tail);
+}
+
+/* Producer side : returns the size of the contiguous free region and
+   its address in *ptr. The region is only published by ring_produce() */
+guint ring_write_region(ring_t *ring, gchar **ptr)
+{
+    guint head, tail, offset, free_space;
+
+    head = (guint)ring->head;
+    tail = (guint)g_atomic_int_get(&ring->tail);
+
+    free_space = ring->size - (head - tail);
+    offset = head & (ring->size - 1);
+
+    *ptr = ring->data + offset;
+
+    return MIN(free_space, ring->size - offset);
+}
+
+void ring_produce(ring_t *ring, guint length)
+{
+    guint fill;
+
+    /* g_atomic_int_set() is a full barrier : the data is visible to
+       the consumer before the new head is */
+    g_atomic_int_set(&ring->head, (gint)((guint)ring->head + length));
+
+    ring->bytes_in += length;
+    fill = ring_fill(ring);
+    if(fill > ring->max_fill)
+	ring->max_fill = fill;
+}
+
+/* Consumer side : returns the size of the contiguous readable region
+   and its address in *ptr. The region is released by ring_consume() */
+guint ring_read_region(ring_t *ring, gchar **ptr)
+{
+    guint head, tail, offset, used;
+
+    tail = (guint)ring->tail;
+    head = (guint)g_atomic_int_get(&ring->head);
+
+    used = head - tail;
+    offset = tail & (ring->size - 1);
+
+    *ptr = ring->data + offset;
+
+    return MIN(used, ring->size - offset);
+}
+
+void ring_consume(ring_t *ring, guint length)
+{
+    g_atomic_int_set(&ring->tail, (gint)((guint)ring->tail + length));
+}
@@ -0,0 +1,45 @@
+/***********************************************************************/
+/* ring.h                                                              */
+/* ------                                                              */
+/*           GTKTerm Software                                          */
+/*                      (c) Julien Schmitt                             */
+/*                                                                     */
+/* ------------------------------------------------------------------- */
+/*                                                                     */
+/*   Purpose                                                           */
+/*      Lock-free single producer / single consumer byte ring          */
+/*      - Header file -                                                */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <glib.h>
+
+/* The producer only ever writes 'head', the consumer only ever writes
+   'tail'. Both are free running counters, the position in 'data' is
+   obtained by masking, so 'size' is always a power of two. */
+typedef struct
+{
+    gchar *data;
+    guint size;
+    volatile gint head;
+    volatile gint tail;
+
+    /* statistics, updated by the producer */
+    guint64 bytes_in;
+    guint max_fill;
+    guint full_count;
+} ring_t;
+
+gboolean ring_init(ring_t *, guint);
+void ring_free(ring_t *);
+void ring_reset(ring_t *);
+guint ring_fill(ring_t *);
+guint ring_write_region(ring_t *, gchar **);
+void ring_produce(ring_t *, guint);
+guint ring_read_region(ring_t *, gchar **);
+void ring_consume(ring_t *, guint);
+
+#endif
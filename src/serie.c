@@ -33,21 +33,31 @@
 #include <string.h>
 #include <errno.h>
 #include <pwd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <time.h>
 
 #include "term_config.h"
 #include "serie.h"
 #include "widgets.h"
 #include "fichier.h"
 #include "buffer.h"
+#include "ring.h"
 #include "i18n.h"
+#include "capture.h"
 
 #include <config.h>
 #include <glib/gi18n.h>
 
-#ifdef HAVE_LINUX_SERIAL_H
+#if defined (HAVE_LINUX_SERIAL_H) || defined (__linux__)
 #include <linux/serial.h>
 #endif
 
+#if defined (TIOCSRS485) && defined (SER_RS485_ENABLED)
+#define RS485_KERNEL
+#endif
+
 
 struct termios termios_save;
 int serial_port_fd = -1;
@@ -56,6 +66,89 @@ guint callback_handler_in, callback_handler_err;
 gboolean callback_activated = FALSE;
 char lockfile[128] = {0};
 
+/* Reader thread : drains the port into rx_ring, the main loop is woken
+   up through reader_wakeup and feeds the ring content to put_chars() */
+static ring_t rx_ring;
+static pthread_t reader_thread;
+static gboolean reader_active = FALSE;
+static volatile gint reader_quit = 0;
+static volatile gint reader_notified = 0;
+static int reader_wakeup[2] = {-1, -1};
+static int reader_stop[2] = {-1, -1};
+static guint callback_handler_ring;
+
+/* Modem lines monitor : a thread waits for the changes of CTS, DSR, CD
+   and RI, and the main loop is woken up through modem_wakeup only when
+   they have changed */
+static pthread_t modem_thread;
+static gboolean modem_active = FALSE;
+static volatile gint modem_quit = 0;
+static volatile gint modem_running = 0;
+static volatile gint modem_lines = 0;
+static volatile gint modem_errno = 0;
+static int modem_wakeup[2] = {-1, -1};
+static int modem_stop[2] = {-1, -1};
+static guint callback_handler_modem;
+
+/* Transmit queue : Send_chars() only queues the data, from any thread.
+   The queue is drained by a G_IO_OUT watch on the port, installed only
+   while there is something to send. Other threads wake up the main
+   loop through tx_wakeup */
+static ring_t tx_ring;
+static pthread_mutex_t tx_lock = PTHREAD_MUTEX_INITIALIZER;
+static gboolean tx_active = FALSE;
+static volatile gint tx_pending = 0;
+static int tx_wakeup[2] = {-1, -1};
+static guint callback_handler_tx_wakeup;
+static guint callback_handler_out = 0;
+static guint64 tx_bytes_out = 0;
+static gint64 tx_window_start = 0;
+static guint tx_window_bytes = 0;
+static guint tx_bytes_per_second = 0;
+static volatile gint tx_write_histogram[TX_WRITE_BUCKETS];
+static volatile gint tx_short_writes = 0;
+
+/* RS485 half-duplex : the queue is sent by a thread, one frame per
+   burst. The driver switches RTS itself when it supports TIOCSRS485,
+   otherwise the thread sets RTS around each frame */
+static pthread_t rs485_thread;
+static gboolean rs485_active = FALSE;
+static gboolean rs485_kernel = FALSE;
+#ifdef RS485_KERNEL
+static struct serial_rs485 rs485_save;
+#endif
+static volatile gint rs485_quit = 0;
+static int rs485_stop[2] = {-1, -1};
+static pthread_mutex_t rs485_lock = PTHREAD_MUTEX_INITIALIZER;
+static gboolean rs485_flush_requested = FALSE;
+static gint rs485_flush_head;             /* ring head at flush_tx() */
+static guint rs485_frames = 0;
+static gint64 rs485_turnaround_last = 0;
+static gint64 rs485_turnaround_min = 0;
+static gint64 rs485_turnaround_max = 0;
+static gint64 rs485_turnaround_total = 0;
+
+/* Bit error rate test : the received data also goes to the checker */
+static prbs_check_t *rx_check = NULL;
+
+/* Port counters : sampled once per second for the status bar, and for
+   stdout with --counters. The UART error counters are read from the
+   driver (TIOCGICOUNT), relative to their value at the opening */
+gboolean print_counters = FALSE;
+
+/* Without window, stdout carries the received data : the traces and
+   the reports go elsewhere */
+gboolean data_on_stdout = FALSE;
+
+/* Every chunk received and sent on stdout : costly, off by default */
+gboolean trace_on_stdout = FALSE;
+static guint64 rx_bytes_in = 0;
+static guint64 counters_tx_base = 0;
+static port_counters_t counters;
+static port_counters_t counters_uart_base;
+static gint64 counters_time = 0;
+static guint callback_handler_counters = 0;
+
 extern struct configuration_port config;
 
 /* Local functions prototype */
@@ -63,38 +156,80 @@ gint create_lockfile(char *);
 void remove_lockfile(void);
 void Ferme_Port(void);
 void Ouvre_Port(char *);
+static gboolean reader_start(void);
+static void reader_end(void);
+static gboolean modem_start(void);
+static void modem_end(void);
+static gboolean tx_start(void);
+static void tx_end(void);
+
+/* Last state of the modem lines, for the capture */
+static gint capture_lines(void)
+{
+    gint lines = g_atomic_int_get(&modem_lines);
 
-gboolean Lis_port(GIOChannel* src, GIOCondition cond, gpointer data)
+    return (lines == MODEM_ERROR) ? 0 : lines;
+}
+
+/* Data already in the buffer */
+static void received_in_place(gchar *c, gint bytes_read)
 {
-    gint bytes_read;
-    static gchar c[BUFFER_RECEPTION];
     guint i;
 
+    /// Trace to STD OUT
+    if(trace_on_stdout == TRUE && data_on_stdout == FALSE)
+	printf("<-- [%.*s]\n", bytes_read, c);
+
+    rx_bytes_in += bytes_read;
+    /* with the reader thread, the capture is done at the read() */
+    if(reader_active == FALSE && capture_running())
+	capture_record(CAPTURE_RX, capture_lines(), c, bytes_read);
+    if(rx_check != NULL)
+	prbs_check(rx_check, (guint8 *)c, bytes_read);
+
+    if(config.car != -1 && waiting_for_char == TRUE)
+    {
+	i = 0;
+	while(i < bytes_read)
+	{
+	    if(c[i] == config.car)
+	    {
+		waiting_for_char = FALSE;
+		add_input();
+		i = bytes_read;
+	    }
+	    i++;
+	}
+    }
+}
+
+static void received_chars(gchar *c, gint bytes_read)
+{
+    /// put to buffer
+    put_chars(c, bytes_read);
+    received_in_place(c, bytes_read);
+}
+
+/* The data is read straight into the free regions of the buffer */
+gboolean Lis_port(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    struct iovec regions[BUFFER_REGIONS];
+    gint bytes_read, count, i;
+    gsize length;
+
     bytes_read = BUFFER_RECEPTION;
 
     while(bytes_read == BUFFER_RECEPTION)
     {
-	bytes_read = read(serial_port_fd, c, BUFFER_RECEPTION);
+	count = buffer_get_free_regions(regions, BUFFER_RECEPTION);
+	bytes_read = readv(serial_port_fd, regions, count);
 	if(bytes_read > 0)
 	{
-	  /// Trace to STD OUT
-      printf("<-- [%s]\n", c);
-      /// put to buffer
-	    put_chars(c, bytes_read, config.crlfauto);
-
-	    if(config.car != -1 && waiting_for_char == TRUE)
+	    buffer_commit(bytes_read);
+	    for(i = 0, length = bytes_read; i < count && length > 0; i++)
 	    {
-		i = 0;
-		while(i < bytes_read)
-		{
-		    if(c[i] == config.car)
-		    {
-			waiting_for_char = FALSE;
-			add_input();
-			i = bytes_read;
-		    }
-		    i++;
-		}
+		received_in_place(regions[i].iov_base, MIN(length, regions[i].iov_len));
+		length -= MIN(length, regions[i].iov_len);
 	    }
 	}
 	else if(bytes_read == -1)
@@ -113,40 +248,1055 @@ gboolean io_err(GIOChannel* src, GIOCondition cond, gpointer data)
     return TRUE;
 }
 
+/* Called from the reader thread : wake up the main loop, but only once
+   until it has started to drain the ring again */
+static void reader_notify(void)
+{
+    if(g_atomic_int_compare_and_exchange(&reader_notified, 0, 1))
+    {
+	if(write(reader_wakeup[1], "", 1) == -1 && errno != EAGAIN)
+	    perror("reader wakeup");
+    }
+}
+
+static void *reader_main(void *data)
+{
+    struct pollfd fds[2];
+    gchar *region;
+    guint length;
+    gint bytes_read;
+
+    fds[0].fd = serial_port_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = reader_stop[0];
+    fds[1].events = POLLIN;
+
+    while(!g_atomic_int_get(&reader_quit))
+    {
+	length = ring_write_region(&rx_ring, &region);
+	if(length == 0)
+	{
+	    /* Ring full : leave the data in the driver (where flow control
+	       can hold the sender) until the main loop catches up */
+	    rx_ring.full_count++;
+	    reader_notify();
+	    while(ring_write_region(&rx_ring, &region) == 0 &&
+		  !g_atomic_int_get(&reader_quit))
+		poll(&fds[1], 1, READER_FULL_WAIT);
+	    continue;
+	}
+
+	if(poll(fds, 2, -1) == -1)
+	{
+	    if(errno == EINTR)
+		continue;
+	    perror("reader poll");
+	    break;
+	}
+
+	if(fds[1].revents != 0)
+	    break;
+
+	/* Errors are handled by io_err() in the main loop */
+	if(fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+	    break;
+
+	bytes_read = read(serial_port_fd, region, length);
+	if(bytes_read > 0)
+	{
+	    if(capture_running())
+		capture_record(CAPTURE_RX, capture_lines(), region, bytes_read);
+	    ring_produce(&rx_ring, bytes_read);
+	    reader_notify();
+	}
+	else if(bytes_read == 0)
+	    break;
+	else if(errno != EAGAIN && errno != EINTR)
+	{
+	    perror(config.port);
+	    break;
+	}
+    }
+
+    reader_notify();
+
+    return NULL;
+}
+
+/* Main loop side of the ring. The amount delivered per call is bounded
+   so that a flood of data cannot starve the GUI */
+static gboolean reader_drain(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    gchar dummy[64];
+    gchar *region;
+    guint length, delivered = 0;
+
+    while(read(reader_wakeup[0], dummy, sizeof(dummy)) > 0)
+	;
+    g_atomic_int_set(&reader_notified, 0);
+
+    while(delivered < READER_DRAIN_MAX &&
+	  (length = ring_read_region(&rx_ring, &region)) != 0)
+    {
+	length = MIN(length, BUFFER_RECEPTION);
+	received_chars(region, length);
+	ring_consume(&rx_ring, length);
+	delivered += length;
+    }
+
+    /* Still some data : make sure we come back */
+    if(ring_fill(&rx_ring) != 0)
+	reader_notify();
+
+    return TRUE;
+}
+
+static gboolean reader_start(void)
+{
+    GIOChannel *channel;
+
+    if(rx_ring.data == NULL && !ring_init(&rx_ring, RING_RECEPTION))
+	return FALSE;
+    ring_reset(&rx_ring);
+
+    if(pipe(reader_wakeup) == -1)
+	return FALSE;
+    if(pipe(reader_stop) == -1)
+    {
+	close(reader_wakeup[0]);
+	close(reader_wakeup[1]);
+	return FALSE;
+    }
+    fcntl(reader_wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(reader_wakeup[1], F_SETFL, O_NONBLOCK);
+
+    g_atomic_int_set(&reader_quit, 0);
+    g_atomic_int_set(&reader_notified, 0);
+
+    channel = g_io_channel_unix_new(reader_wakeup[0]);
+    callback_handler_ring = g_io_add_watch_full(channel,
+						10,
+						G_IO_IN,
+						(GIOFunc)reader_drain,
+						NULL, NULL);
+    g_io_channel_unref(channel);
+
+    if(pthread_create(&reader_thread, NULL, reader_main, NULL) != 0)
+    {
+	g_source_remove(callback_handler_ring);
+	close(reader_wakeup[0]);
+	close(reader_wakeup[1]);
+	close(reader_stop[0]);
+	close(reader_stop[1]);
+	return FALSE;
+    }
+    reader_active = TRUE;
+
+    return TRUE;
+}
+
+static void reader_end(void)
+{
+    if(reader_active == FALSE)
+	return;
+
+    g_atomic_int_set(&reader_quit, 1);
+    if(write(reader_stop[1], "", 1) == -1)
+	perror("reader stop");
+    pthread_join(reader_thread, NULL);
+    g_source_remove(callback_handler_ring);
+
+    /* Deliver what the thread has read before the port is closed */
+    while(ring_fill(&rx_ring) != 0)
+	reader_drain(NULL, G_IO_IN, NULL);
+
+    close(reader_wakeup[0]);
+    close(reader_wakeup[1]);
+    close(reader_stop[0]);
+    close(reader_stop[1]);
+    reader_active = FALSE;
+}
+
+gchar *get_reader_stats(void)
+{
+    if(rx_ring.data == NULL)
+	return g_strdup(_("Reader thread not used"));
+
+    return g_strdup_printf(_("Reader thread: %" G_GUINT64_FORMAT " bytes read, "
+			     "max ring occupancy %u/%u bytes, ring full %u times"),
+			   rx_ring.bytes_in,
+			   rx_ring.max_fill,
+			   rx_ring.size,
+			   rx_ring.full_count);
+}
+
+/* Only there to make TIOCMIWAIT return with EINTR */
+static void modem_interrupt(int signal)
+{
+}
+
+static void modem_post(gint lines)
+{
+    g_atomic_int_set(&modem_lines, lines);
+    if(write(modem_wakeup[1], "", 1) == -1 && errno != EAGAIN)
+	perror("modem wakeup");
+}
+
+/* Blocks in TIOCMIWAIT while the driver supports it. Otherwise, polls
+   the lines with a period doubled each time they did not change, from
+   MODEM_POLL_MIN up to MODEM_POLL_MAX */
+static void *modem_main(void *data)
+{
+    struct pollfd stop;
+    int lines, last = -1;
+    gint period = MODEM_POLL_MIN;
+    gboolean wait_supported = TRUE;
+
+    stop.fd = modem_stop[0];
+    stop.events = POLLIN;
+
+    while(!g_atomic_int_get(&modem_quit))
+    {
+	if(ioctl(serial_port_fd, TIOCMGET, &lines) == -1)
+	{
+	    /* Some serial ports genuinely lack these lines : nothing to
+	       monitor. Other errors are reported by the main loop */
+	    if(errno != EINVAL && errno != ENOTTY)
+	    {
+		g_atomic_int_set(&modem_errno, errno);
+		modem_post(MODEM_ERROR);
+	    }
+	    break;
+	}
+
+	if(lines != last)
+	{
+	    modem_post(lines);
+	    last = lines;
+	    period = MODEM_POLL_MIN;
+	}
+	else
+	    period = MIN(period * 2, MODEM_POLL_MAX);
+
+	if(wait_supported)
+	{
+	    if(ioctl(serial_port_fd, TIOCMIWAIT, TIOCM_CTS | TIOCM_DSR | TIOCM_CD | TIOCM_RNG) == 0 ||
+	       errno == EINTR)
+		continue;
+	    wait_supported = FALSE;
+	    period = MODEM_POLL_MIN;
+	}
+
+	if(poll(&stop, 1, period) > 0)
+	    break;
+    }
+
+    g_atomic_int_set(&modem_running, 0);
+
+    return NULL;
+}
+
+static gboolean modem_changed(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    gchar dummy[64];
+    gint lines;
+
+    while(read(modem_wakeup[0], dummy, sizeof(dummy)) > 0)
+	;
+
+    lines = g_atomic_int_get(&modem_lines);
+    if(lines == MODEM_ERROR)
+    {
+	errno = g_atomic_int_get(&modem_errno);
+	i18n_perror(_("Control signals read"));
+	Ferme_Port();
+	return FALSE;
+    }
+
+    show_control_signals(lines);
+
+    return TRUE;
+}
+
+static gboolean modem_start(void)
+{
+    GIOChannel *channel;
+    struct sigaction action;
+
+    /* No SA_RESTART : the signal interrupts TIOCMIWAIT */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = modem_interrupt;
+    sigemptyset(&action.sa_mask);
+    sigaction(MODEM_SIGNAL, &action, NULL);
+
+    if(pipe(modem_wakeup) == -1)
+	return FALSE;
+    if(pipe(modem_stop) == -1)
+    {
+	close(modem_wakeup[0]);
+	close(modem_wakeup[1]);
+	return FALSE;
+    }
+    fcntl(modem_wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(modem_wakeup[1], F_SETFL, O_NONBLOCK);
+
+    g_atomic_int_set(&modem_quit, 0);
+    g_atomic_int_set(&modem_running, 1);
+
+    channel = g_io_channel_unix_new(modem_wakeup[0]);
+    callback_handler_modem = g_io_add_watch_full(channel,
+						 10,
+						 G_IO_IN,
+						 (GIOFunc)modem_changed,
+						 NULL, NULL);
+    g_io_channel_unref(channel);
+
+    if(pthread_create(&modem_thread, NULL, modem_main, NULL) != 0)
+    {
+	g_source_remove(callback_handler_modem);
+	close(modem_wakeup[0]);
+	close(modem_wakeup[1]);
+	close(modem_stop[0]);
+	close(modem_stop[1]);
+	return FALSE;
+    }
+    modem_active = TRUE;
+
+    return TRUE;
+}
+
+static void modem_end(void)
+{
+    if(modem_active == FALSE)
+	return;
+    modem_active = FALSE;
+
+    g_atomic_int_set(&modem_quit, 1);
+    if(write(modem_stop[1], "", 1) == -1)
+	perror("modem stop");
+    /* The signal may come just before the thread enters TIOCMIWAIT :
+       send it again until the thread is gone */
+    while(g_atomic_int_get(&modem_running))
+    {
+	pthread_kill(modem_thread, MODEM_SIGNAL);
+	poll(NULL, 0, 1);
+    }
+    pthread_join(modem_thread, NULL);
+    g_source_remove(callback_handler_modem);
+
+    close(modem_wakeup[0]);
+    close(modem_wakeup[1]);
+    close(modem_stop[0]);
+    close(modem_stop[1]);
+}
+
+static void tx_count(guint bytes)
+{
+    gint64 now = g_get_monotonic_time();
+
+    tx_bytes_out += bytes;
+    tx_window_bytes += bytes;
+    if(now - tx_window_start >= G_USEC_PER_SEC)
+    {
+	tx_bytes_per_second = tx_window_bytes;
+	tx_window_bytes = 0;
+	tx_window_start = now;
+    }
+}
+
+/* Bucket n counts the write() calls which took less than 2^n us */
+static void tx_write_count(gint64 duration, gboolean short_write)
+{
+    gint bucket = 0;
+
+    while(duration > 0 && bucket < TX_WRITE_BUCKETS - 1)
+    {
+	duration >>= 1;
+	bucket++;
+    }
+    g_atomic_int_inc(&tx_write_histogram[bucket]);
+    if(short_write)
+	g_atomic_int_inc(&tx_short_writes);
+}
+
+/* Called when the port is writable : the driver applies the flow
+   control, so the watch is simply not called while the line is held */
+static gboolean tx_drain(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    gchar *region;
+    guint length;
+    gint bytes_written;
+    gint64 start;
+
+    while((length = ring_read_region(&tx_ring, &region)) != 0)
+    {
+	start = g_get_monotonic_time();
+	bytes_written = write(serial_port_fd, region, length);
+	tx_write_count(g_get_monotonic_time() - start, bytes_written != (gint)length);
+	if(bytes_written == -1)
+	{
+	    if(errno == EAGAIN || errno == EINTR)
+		return TRUE;
+	    /* the error itself is handled by io_err() : drop the queue */
+	    perror(config.port);
+	    ring_consume(&tx_ring, ring_fill(&tx_ring));
+	    break;
+	}
+	if(capture_running())
+	    capture_record(CAPTURE_TX, capture_lines(), region, bytes_written);
+	ring_consume(&tx_ring, bytes_written);
+	tx_count(bytes_written);
+	if((guint)bytes_written < length)
+	    return TRUE;
+    }
+
+    /* Keep the watch if something was queued in the meantime */
+    g_atomic_int_set(&tx_pending, 0);
+    if(ring_fill(&tx_ring) != 0 && g_atomic_int_compare_and_exchange(&tx_pending, 0, 1))
+	return TRUE;
+
+    callback_handler_out = 0;
+    return FALSE;
+}
+
+static gboolean tx_wakeup_read(GIOChannel* src, GIOCondition cond, gpointer data)
+{
+    GIOChannel *channel;
+    gchar dummy[64];
+
+    while(read(tx_wakeup[0], dummy, sizeof(dummy)) > 0)
+	;
+
+    if(callback_handler_out == 0)
+    {
+	channel = g_io_channel_unix_new(serial_port_fd);
+	callback_handler_out = g_io_add_watch_full(channel,
+						   10,
+						   G_IO_OUT,
+						   (GIOFunc)tx_drain,
+						   NULL, NULL);
+	g_io_channel_unref(channel);
+    }
+
+    return TRUE;
+}
+
+/* Time needed by the line to send 'bytes', in us */
+static gint64 tx_wire_time(gsize bytes)
+{
+    guint line_rate;
+
+    line_rate = get_line_rate();
+    if(line_rate == 0)
+	return 0;
+
+    return (gint64)bytes * G_USEC_PER_SEC / line_rate;
+}
+
+static void rs485_rts(gboolean on)
+{
+    int bits = TIOCM_RTS;
+
+    if(ioctl(serial_port_fd, on ? TIOCMBIS : TIOCMBIC, &bits) == -1)
+	perror("RS485 RTS");
+}
+
+static void rs485_sleep_until(gint64 when)
+{
+    struct timespec ts;
+
+    ts.tv_sec = when / G_USEC_PER_SEC;
+    ts.tv_nsec = (when % G_USEC_PER_SEC) * 1000;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	;
+}
+
+/* Waits until the port accepts data, or until flush_tx() wakes the
+   thread up. Returns FALSE when stopped */
+static gboolean rs485_wait_writable(void)
+{
+    struct pollfd fds[3];
+    gchar dummy[64];
+
+    fds[0].fd = serial_port_fd;
+    fds[0].events = POLLOUT;
+    fds[1].fd = rs485_stop[0];
+    fds[1].events = POLLIN;
+    fds[2].fd = tx_wakeup[0];
+    fds[2].events = POLLIN;
+
+    while(poll(fds, 3, -1) == -1)
+    {
+	if(errno != EINTR)
+	    return FALSE;
+    }
+    if(fds[2].revents != 0)
+    {
+	while(read(tx_wakeup[0], dummy, sizeof(dummy)) > 0)
+	    ;
+    }
+
+    return (fds[1].revents == 0);
+}
+
+/* The thread is the only reader of the ring : it drops itself what was
+   queued before flush_tx(), between two writes. TRUE if it did */
+static gboolean rs485_flushed(void)
+{
+    gboolean flushed;
+    gint dropped;
+
+    pthread_mutex_lock(&rs485_lock);
+    flushed = rs485_flush_requested;
+    if(flushed)
+    {
+	dropped = rs485_flush_head - tx_ring.tail;
+	if(dropped > 0)
+	    ring_consume(&tx_ring, dropped);
+	rs485_flush_requested = FALSE;
+    }
+    pthread_mutex_unlock(&rs485_lock);
+
+    return flushed;
+}
+
+/* Sends what is queued as one frame. The turnaround is the time between
+   the end of the frame on the wire and the release of the bus */
+static void rs485_frame(void)
+{
+    gchar *region;
+    guint length;
+    gint bytes_written;
+    gsize bytes = 0;
+    gint64 start, drained, released, turnaround, call;
+#ifdef TIOCSERGETLSR
+    unsigned int lsr;
+    gint spins;
+#endif
+
+    rs485_flushed();
+    if(ring_fill(&tx_ring) == 0)
+	return;
+
+    start = g_get_monotonic_time();
+    if(rs485_kernel == FALSE)
+    {
+	rs485_rts(TRUE);
+	rs485_sleep_until(start + (gint64)config.rs485_rts_time_before_transmit * 1000);
+    }
+    else
+	start += (gint64)config.rs485_rts_time_before_transmit * 1000;
+
+    while(rs485_flushed() == FALSE && (length = ring_read_region(&tx_ring, &region)) != 0)
+    {
+	call = g_get_monotonic_time();
+	bytes_written = write(serial_port_fd, region, length);
+	tx_write_count(g_get_monotonic_time() - call, bytes_written != (gint)length);
+	if(bytes_written == -1)
+	{
+	    if(errno == EAGAIN || errno == EINTR)
+	    {
+		if(rs485_wait_writable() == FALSE)
+		    break;
+		continue;
+	    }
+	    perror(config.port);
+	    bytes_written = length;
+	}
+	else if(capture_running())
+	    capture_record(CAPTURE_TX, capture_lines(), region, bytes_written);
+
+	ring_consume(&tx_ring, bytes_written);
+	tx_count(bytes_written);
+	bytes += bytes_written;
+    }
+
+    /* wait all chars are send */
+    tcdrain(serial_port_fd);
+#ifdef TIOCSERGETLSR
+    /* some drivers return before the shift register is empty */
+    for(spins = 0; spins < 1000; spins++)
+    {
+	if(ioctl(serial_port_fd, TIOCSERGETLSR, &lsr) == -1 || (lsr & TIOCSER_TEMT))
+	    break;
+	rs485_sleep_until(g_get_monotonic_time() + 20);
+    }
+#endif
+    drained = g_get_monotonic_time();
+
+    if(rs485_kernel == FALSE)
+    {
+	rs485_sleep_until(drained + (gint64)config.rs485_rts_time_after_transmit * 1000);
+	rs485_rts(FALSE);
+	released = g_get_monotonic_time();
+    }
+    else
+    {
+	/* the driver releases RTS on its own : only an estimate */
+	released = drained + (gint64)config.rs485_rts_time_after_transmit * 1000;
+    }
+
+    turnaround = MAX(released - (start + tx_wire_time(bytes)), 0);
+
+    pthread_mutex_lock(&rs485_lock);
+    if(rs485_frames == 0 || turnaround < rs485_turnaround_min)
+	rs485_turnaround_min = turnaround;
+    if(turnaround > rs485_turnaround_max)
+	rs485_turnaround_max = turnaround;
+    rs485_turnaround_last = turnaround;
+    rs485_turnaround_total += turnaround;
+    rs485_frames++;
+    pthread_mutex_unlock(&rs485_lock);
+}
+
+static void *rs485_main(void *data)
+{
+    struct pollfd fds[2];
+    gchar dummy[64];
+
+    fds[0].fd = tx_wakeup[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = rs485_stop[0];
+    fds[1].events = POLLIN;
+
+    while(!g_atomic_int_get(&rs485_quit))
+    {
+	if(poll(fds, 2, -1) == -1)
+	{
+	    if(errno == EINTR)
+		continue;
+	    perror("RS485 transmitter");
+	    break;
+	}
+	if(fds[1].revents != 0)
+	    break;
+
+	while(read(tx_wakeup[0], dummy, sizeof(dummy)) > 0)
+	    ;
+
+	/* Send again if something was queued in the meantime */
+	do
+	{
+	    rs485_frame();
+	    g_atomic_int_set(&tx_pending, 0);
+	}
+	while(!g_atomic_int_get(&rs485_quit) && ring_fill(&tx_ring) != 0 &&
+	      g_atomic_int_compare_and_exchange(&tx_pending, 0, 1));
+    }
+
+    return NULL;
+}
+
+static gboolean rs485_start(void)
+{
+#ifdef RS485_KERNEL
+    struct serial_rs485 rs485;
+#endif
+
+    rs485_kernel = FALSE;
+#ifdef RS485_KERNEL
+    if(ioctl(serial_port_fd, TIOCGRS485, &rs485_save) == 0)
+    {
+	memcpy(&rs485, &rs485_save, sizeof(rs485));
+	rs485.flags |= SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+	rs485.flags &= ~SER_RS485_RTS_AFTER_SEND;
+	rs485.delay_rts_before_send = config.rs485_rts_time_before_transmit;
+	rs485.delay_rts_after_send = config.rs485_rts_time_after_transmit;
+	if(ioctl(serial_port_fd, TIOCSRS485, &rs485) == 0)
+	    rs485_kernel = TRUE;
+    }
+#endif
+    /* receiving */
+    if(rs485_kernel == FALSE)
+	rs485_rts(FALSE);
+
+    if(pipe(rs485_stop) == -1)
+	return FALSE;
+
+    g_atomic_int_set(&rs485_quit, 0);
+    rs485_flush_requested = FALSE;
+    rs485_frames = 0;
+    rs485_turnaround_last = 0;
+    rs485_turnaround_min = 0;
+    rs485_turnaround_max = 0;
+    rs485_turnaround_total = 0;
+
+    if(pthread_create(&rs485_thread, NULL, rs485_main, NULL) != 0)
+    {
+	close(rs485_stop[0]);
+	close(rs485_stop[1]);
+	return FALSE;
+    }
+    rs485_active = TRUE;
+
+    return TRUE;
+}
+
+static void rs485_end(void)
+{
+    if(rs485_active == FALSE)
+	return;
+    rs485_active = FALSE;
+
+    g_atomic_int_set(&rs485_quit, 1);
+    if(write(rs485_stop[1], "", 1) == -1)
+	perror("RS485 stop");
+    pthread_join(rs485_thread, NULL);
+
+    close(rs485_stop[0]);
+    close(rs485_stop[1]);
+
+#ifdef RS485_KERNEL
+    if(rs485_kernel == TRUE)
+	ioctl(serial_port_fd, TIOCSRS485, &rs485_save);
+#endif
+    if(rs485_kernel == FALSE)
+	rs485_rts(FALSE);
+}
+
+static gboolean tx_start(void)
+{
+    GIOChannel *channel;
+
+    if(tx_ring.data == NULL && !ring_init(&tx_ring, TX_QUEUE_SIZE))
+	return FALSE;
+    ring_reset(&tx_ring);
+
+    if(pipe(tx_wakeup) == -1)
+	return FALSE;
+    fcntl(tx_wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(tx_wakeup[1], F_SETFL, O_NONBLOCK);
+
+    g_atomic_int_set(&tx_pending, 0);
+
+    if(config.flux == 3)
+    {
+	if(rs485_start() == FALSE)
+	{
+	    close(tx_wakeup[0]);
+	    close(tx_wakeup[1]);
+	    return FALSE;
+	}
+    }
+    else
+    {
+	channel = g_io_channel_unix_new(tx_wakeup[0]);
+	callback_handler_tx_wakeup = g_io_add_watch_full(channel,
+							 10,
+							 G_IO_IN,
+							 (GIOFunc)tx_wakeup_read,
+							 NULL, NULL);
+	g_io_channel_unref(channel);
+    }
+
+    pthread_mutex_lock(&tx_lock);
+    tx_active = TRUE;
+    pthread_mutex_unlock(&tx_lock);
+
+    return TRUE;
+}
+
+static void tx_end(void)
+{
+    guint dropped;
+
+    pthread_mutex_lock(&tx_lock);
+    if(tx_active == FALSE)
+    {
+	pthread_mutex_unlock(&tx_lock);
+	return;
+    }
+    tx_active = FALSE;
+    pthread_mutex_unlock(&tx_lock);
+
+    if(rs485_active == TRUE)
+	rs485_end();
+    else
+    {
+	if(callback_handler_out != 0)
+	    g_source_remove(callback_handler_out);
+	callback_handler_out = 0;
+	g_source_remove(callback_handler_tx_wakeup);
+    }
+    close(tx_wakeup[0]);
+    close(tx_wakeup[1]);
+
+    dropped = ring_fill(&tx_ring);
+    if(dropped != 0)
+	i18n_fprintf(stderr, _("Port closed, %u bytes not sent\n"), dropped);
+    ring_reset(&tx_ring);
+}
+
+/* Queues the data to send. Returns the number of bytes queued, which is
+   less than 'length' when the queue is full : the caller has to try
+   again later with the rest */
 int Send_chars(char *string, int length)
 {
-    int bytes_written = 0;
+    gchar *region;
+    guint room;
+    int queued = 0;
 
     /* Normally it never happens, but it is better not to segfault ;) */
     if(length == 0)
         return 0;
 
-    if(serial_port_fd == -1)
-        return 0;
+    pthread_mutex_lock(&tx_lock);
+    if(tx_active == FALSE)
+    {
+	pthread_mutex_unlock(&tx_lock);
+	return 0;
+    }
 
-    /* RS485 half-duplex mode ? */
-    if( config.flux==3 )
+    while(queued < length && (room = ring_write_region(&tx_ring, &region)) != 0)
     {
-	/* set RTS (start to send) */
-	Set_signals( 1 );
-	if( config.rs485_rts_time_before_transmit>0 )
-	    usleep(config.rs485_rts_time_before_transmit*1000);
+	room = MIN(room, (guint)(length - queued));
+	memcpy(region, string + queued, room);
+	ring_produce(&tx_ring, room);
+	queued += room;
     }
+    if(queued < length)
+	tx_ring.full_count++;
+
+    if(queued > 0 && g_atomic_int_compare_and_exchange(&tx_pending, 0, 1))
+    {
+	if(write(tx_wakeup[1], "", 1) == -1 && errno != EAGAIN)
+	    perror("transmit wakeup");
+    }
+    pthread_mutex_unlock(&tx_lock);
+
+    return queued;
+}
+
+/* Number of bytes accepted by Send_chars() that are not on the wire yet :
+   still in the queue, or in the output buffer of the driver */
+guint get_tx_pending(void)
+{
+    guint pending;
+    int outq = 0;
 
-    bytes_written = write(serial_port_fd, string, length);
+    pending = ring_fill(&tx_ring);
+#ifdef TIOCOUTQ
+    if(serial_port_fd != -1 && ioctl(serial_port_fd, TIOCOUTQ, &outq) == 0 && outq > 0)
+	pending += outq;
+#endif
+
+    return pending;
+}
 
-    /* RS485 half-duplex mode ? */
-    if( config.flux==3 )
+/* Drops everything not sent yet. The queue is only consumed from the
+   main loop or from the RS485 thread, so this must be called from the
+   main loop */
+void flush_tx(void)
+{
+    pthread_mutex_lock(&tx_lock);
+    if(rs485_active == TRUE)
     {
-	/* wait all chars are send */
-	tcdrain( serial_port_fd );
-	if( config.rs485_rts_time_after_transmit>0 )
-	    usleep(config.rs485_rts_time_after_transmit*1000);
-	/* reset RTS (end of send, now receiving back) */
-	Set_signals( 1 );
+	/* the transmit thread drops it, a write may be in progress */
+	pthread_mutex_lock(&rs485_lock);
+	rs485_flush_head = tx_ring.head;
+	rs485_flush_requested = TRUE;
+	pthread_mutex_unlock(&rs485_lock);
+	if(write(tx_wakeup[1], "", 1) == -1 && errno != EAGAIN)
+	    perror("transmit wakeup");
     }
+    else
+	ring_consume(&tx_ring, ring_fill(&tx_ring));
+    pthread_mutex_unlock(&tx_lock);
 
-    return bytes_written;
+    if(serial_port_fd != -1)
+	tcflush(serial_port_fd, TCOFLUSH);
+}
+
+/* TRUE once the last queued byte has left the UART : the transmit
+   shift register is checked when the driver tells it. Otherwise (most
+   USB adapters) only the driver queue is known : the FIFO is not
+   waited for, this is called from the main loop and must not block */
+gboolean tx_wire_empty(void)
+{
+#ifdef TIOCSERGETLSR
+    unsigned int lsr;
+#endif
+
+    if(get_tx_pending() != 0)
+	return FALSE;
+    if(serial_port_fd == -1)
+	return TRUE;
+#ifdef TIOCSERGETLSR
+    if(ioctl(serial_port_fd, TIOCSERGETLSR, &lsr) == 0)
+	return (lsr & TIOCSER_TEMT) != 0;
+#endif
+
+    return TRUE;
+}
+
+/* Theoretical limit of the line in bytes/s with the current settings :
+   a start bit, the data bits, the parity bit and the stop bits */
+guint get_line_rate(void)
+{
+    gint bits;
+
+    bits = 1 + config.bits + (config.parite != 0 ? 1 : 0) + config.stops;
+
+    return config.vitesse / bits;
+}
+
+/* 'histogram' must hold TX_WRITE_BUCKETS counters */
+void get_tx_write_stats(guint *histogram, guint *short_writes)
+{
+    gint i;
+
+    for(i = 0; i < TX_WRITE_BUCKETS; i++)
+	histogram[i] = g_atomic_int_get(&tx_write_histogram[i]);
+    *short_writes = g_atomic_int_get(&tx_short_writes);
+}
+
+void reset_tx_write_stats(void)
+{
+    gint i;
+
+    for(i = 0; i < TX_WRITE_BUCKETS; i++)
+	g_atomic_int_set(&tx_write_histogram[i], 0);
+    g_atomic_int_set(&tx_short_writes, 0);
+}
+
+/* NULL stops the check */
+void set_rx_check(prbs_check_t *check)
+{
+    rx_check = check;
+}
+
+/* Absolute values of the UART error counters */
+static gboolean counters_uart(port_counters_t *uart)
+{
+#if defined (TIOCGICOUNT) && (defined (HAVE_LINUX_SERIAL_H) || defined (__linux__))
+    struct serial_icounter_struct icount;
+
+    if(ioctl(serial_port_fd, TIOCGICOUNT, &icount) == -1)
+	return FALSE;
+
+    uart->overrun = icount.overrun;
+    uart->buf_overrun = icount.buf_overrun;
+    uart->frame = icount.frame;
+    uart->parity = icount.parity;
+    uart->brk = icount.brk;
+
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+static gboolean counters_sample(gpointer data)
+{
+    port_counters_t uart;
+    guint64 rx_bytes, tx_bytes;
+    gint64 now, elapsed;
+    gchar *text;
+    FILE *output;
+
+    now = g_get_monotonic_time();
+    elapsed = MAX(now - counters_time, 1);
+    rx_bytes = rx_bytes_in;
+    tx_bytes = tx_bytes_out - counters_tx_base;
+
+    counters.rx_rate = (rx_bytes - counters.rx_bytes) * G_USEC_PER_SEC / elapsed;
+    counters.tx_rate = (tx_bytes - counters.tx_bytes) * G_USEC_PER_SEC / elapsed;
+    counters.rx_bytes = rx_bytes;
+    counters.tx_bytes = tx_bytes;
+    counters_time = now;
+
+    if(counters.uart_valid && counters_uart(&uart))
+    {
+	counters.overrun = uart.overrun - counters_uart_base.overrun;
+	counters.buf_overrun = uart.buf_overrun - counters_uart_base.buf_overrun;
+	counters.frame = uart.frame - counters_uart_base.frame;
+	counters.parity = uart.parity - counters_uart_base.parity;
+	counters.brk = uart.brk - counters_uart_base.brk;
+    }
+
+    show_port_counters();
+    if(print_counters == TRUE)
+    {
+	text = get_port_counters_string();
+	output = data_on_stdout ? stderr : stdout;
+	fprintf(output, "%s\n", text);
+	fflush(output);
+	g_free(text);
+    }
+
+    return TRUE;
+}
+
+static void counters_start(void)
+{
+    memset(&counters, 0, sizeof(counters));
+    rx_bytes_in = 0;
+    counters_tx_base = tx_bytes_out;
+    counters.uart_valid = counters_uart(&counters_uart_base);
+    counters_time = g_get_monotonic_time();
+    callback_handler_counters = g_timeout_add(COUNTERS_INTERVAL, counters_sample, NULL);
+}
+
+static void counters_end(void)
+{
+    if(callback_handler_counters != 0)
+	g_source_remove(callback_handler_counters);
+    callback_handler_counters = 0;
+}
+
+void get_port_counters(port_counters_t *values)
+{
+    *values = counters;
+}
+
+gchar *get_port_counters_string(void)
+{
+    if(counters.uart_valid == FALSE)
+	return g_strdup_printf(_("RX %u bytes/s, %" G_GUINT64_FORMAT " bytes, TX %u bytes/s, %"
+				 G_GUINT64_FORMAT " bytes, no UART counters"),
+			       counters.rx_rate, counters.rx_bytes,
+			       counters.tx_rate, counters.tx_bytes);
+
+    return g_strdup_printf(_("RX %u bytes/s, %" G_GUINT64_FORMAT " bytes, TX %u bytes/s, %"
+			     G_GUINT64_FORMAT " bytes, overrun %u, buf_overrun %u, frame %u, parity %u, brk %u"),
+			   counters.rx_rate, counters.rx_bytes,
+			   counters.tx_rate, counters.tx_bytes,
+			   counters.overrun, counters.buf_overrun,
+			   counters.frame, counters.parity, counters.brk);
+}
+
+gchar *get_tx_stats(void)
+{
+    gchar *stats, *rs485;
+
+    /* refresh the rate if nothing was sent for a while */
+    tx_count(0);
+
+    stats = g_strdup_printf(_("Transmit queue: %u bytes queued (max %u/%u), %u bytes/s, "
+			      "%" G_GUINT64_FORMAT " bytes sent, queue full %u times"),
+			    ring_fill(&tx_ring),
+			    tx_ring.max_fill,
+			    tx_ring.size,
+			    tx_bytes_per_second,
+			    tx_bytes_out,
+			    tx_ring.full_count);
+    if(rs485_active == FALSE)
+	return stats;
+
+    pthread_mutex_lock(&rs485_lock);
+    rs485 = g_strdup_printf(_("%s ; RS485 (%s): %u frames, turnaround %" G_GINT64_FORMAT " us "
+			      "(min %" G_GINT64_FORMAT ", avg %" G_GINT64_FORMAT ", max %" G_GINT64_FORMAT ")"),
+			    stats,
+			    rs485_kernel ? _("driver, estimated") : _("software, measured"),
+			    rs485_frames,
+			    rs485_turnaround_last,
+			    rs485_turnaround_min,
+			    rs485_frames ? rs485_turnaround_total / rs485_frames : 0,
+			    rs485_turnaround_max);
+    pthread_mutex_unlock(&rs485_lock);
+    g_free(stats);
+
+    return rs485;
 }
 
 void Ouvre_Port(char *port)
@@ -162,6 +1312,8 @@ gboolean Config_port(void)
     Ferme_Port();
     remove_lockfile();
 
+    set_buffer_size((gsize)config.buffer_size * 1024 * 1024);
+
     Ouvre_Port(config.port);
 
 
@@ -283,11 +1435,17 @@ gboolean Config_port(void)
     tcflush(serial_port_fd, TCOFLUSH);
     tcflush(serial_port_fd, TCIFLUSH);
 
-    callback_handler_in = g_io_add_watch_full(g_io_channel_unix_new(serial_port_fd),
-					   10,
-					   G_IO_IN, 
-					   (GIOFunc)Lis_port, 
-					   NULL, NULL);
+    if(config.reader_thread == FALSE || reader_start() == FALSE)
+    {
+	if(config.reader_thread == TRUE)
+	    i18n_fprintf(stderr, _("Cannot start reader thread, reading from the main loop\n"));
+
+	callback_handler_in = g_io_add_watch_full(g_io_channel_unix_new(serial_port_fd),
+					       10,
+					       G_IO_IN,
+					       (GIOFunc)Lis_port,
+					       NULL, NULL);
+    }
 
     callback_handler_err = g_io_add_watch_full(g_io_channel_unix_new(serial_port_fd),
 					   10,
@@ -295,6 +1453,20 @@ gboolean Config_port(void)
 					   (GIOFunc)io_err, 
 					   NULL, NULL);
 
+    if(modem_start() == FALSE)
+	i18n_fprintf(stderr, _("Cannot start the control signals monitor\n"));
+
+    if(tx_start() == FALSE)
+    {
+	Ferme_Port();
+	msg = g_strdup_printf(_("Cannot create the transmit queue\n"));
+	show_message(msg, MSG_ERR);
+	g_free(msg);
+
+	return FALSE;
+    }
+
+    counters_start();
     callback_activated = TRUE;
 
     Set_local_echo(config.echo);
@@ -318,7 +1490,13 @@ void Ferme_Port(void)
     {
 	if(callback_activated == TRUE)
 	{
-	    g_source_remove(callback_handler_in);
+	    if(reader_active == TRUE)
+		reader_end();
+	    else
+		g_source_remove(callback_handler_in);
+	    modem_end();
+	    tx_end();
+	    counters_end();
 	    g_source_remove(callback_handler_err);
 	    callback_activated = FALSE;
 	}
@@ -365,41 +1543,25 @@ void Set_signals(guint param)
     }
 }
 
+/* Reads the control signals now : returns the TIOCMGET value, or -1 */
 int lis_sig(void)
 {
-    static int stat = 0;
     int stat_read;
 
-  if ( config.flux==3 )
-  {
-    //reset RTS (default = receive)
-    Set_signals( 1 );
-  }
+    if(serial_port_fd == -1)
+	return -1;
 
-    if(serial_port_fd != -1)
+    if(ioctl(serial_port_fd, TIOCMGET, &stat_read) == -1)
     {
-	if(ioctl(serial_port_fd, TIOCMGET, &stat_read) == -1)
-	{
-            /* Ignore EINVAL, as some serial ports
-	       genuinely lack these lines */
-	    /* Thanks to Elie De Brauwer on ubuntu launchpad */
-	    if (errno != EINVAL)
-	    {
-		i18n_perror(_("Control signals read"));
-		Ferme_Port();
-	    }
-
-	    return -2;
-	}
-
-	if(stat_read == stat)
-	    return -1;
-
-	stat = stat_read;
-
-	return stat;
+	/* Ignore EINVAL, as some serial ports
+	   genuinely lack these lines */
+	/* Thanks to Elie De Brauwer on ubuntu launchpad */
+	if(errno != EINVAL && errno != ENOTTY)
+	    i18n_perror(_("Control signals read"));
+	return -1;
     }
-    return -1;
+
+    return stat_read;
 }
 
 /*
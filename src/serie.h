@@ -15,7 +15,27 @@
 #ifndef SERIE_H_
 #define SERIE_H_
 
+#include "prbs.h"
+
 extern int serial_port_fd;
+extern gboolean print_counters;
+extern gboolean data_on_stdout;
+extern gboolean trace_on_stdout;
+
+/* Since the port was opened */
+typedef struct
+{
+    guint64 rx_bytes;
+    guint64 tx_bytes;
+    guint rx_rate;              /* bytes/s over the last second */
+    guint tx_rate;
+    gboolean uart_valid;        /* TIOCGICOUNT supported by the driver */
+    guint overrun;              /* UART FIFO full */
+    guint buf_overrun;          /* tty buffer full */
+    guint frame;
+    guint parity;
+    guint brk;
+} port_counters_t;
 
 int Send_chars(char *, int);
 gboolean Config_port(void);
@@ -27,13 +47,32 @@ void configure_crlfauto(gboolean);
 void sendbreak(void);
 gint set_custom_speed(int, int);
 gchar* get_port_string(void);
+gchar *get_reader_stats(void);
+gchar *get_tx_stats(void);
+guint get_tx_pending(void);
+gboolean tx_wire_empty(void);
+void flush_tx(void);
+guint get_line_rate(void);
+void get_tx_write_stats(guint *, guint *);
+void reset_tx_write_stats(void);
+void set_rx_check(prbs_check_t *);
+void get_port_counters(port_counters_t *);
+gchar *get_port_counters_string(void);
 
 
 #define BUFFER_RECEPTION 8192
-#define BUFFER_EMISSION 4096
+#define TX_QUEUE_SIZE (1024 * 1024)     /* transmit queue size */
+#define TX_WRITE_BUCKETS 24             /* write() latency histogram, 1 us to 8 s */
+#define RING_RECEPTION (1024 * 1024)    /* reader thread ring size */
+#define READER_DRAIN_MAX (64 * 1024)    /* max bytes handled per wakeup */
+#define READER_FULL_WAIT 1              /* in ms (ring full) */
 #define LINE_FEED 0x0A
-#define POLL_DELAY 1               /* in ms (for control signals) */
+#define MODEM_POLL_MIN 10          /* in ms (for control signals, */
+#define MODEM_POLL_MAX 500         /* when TIOCMIWAIT is not supported) */
+#define MODEM_SIGNAL SIGUSR1       /* stops the control signals monitor */
+#define MODEM_ERROR -2
 #define P_LOCK "/var/lock"           /* lock file location */
+#define COUNTERS_INTERVAL 1000     /* in ms (port counters sampling) */
 
 
 #endif
@@ -47,6 +47,8 @@
 #include "widgets.h"
 #include "parsecfg.h"
 #include "macros.h"
+#include "buffer.h"
+#include "fichier.h"
 #include "i18n.h"
 #include "config.h"
 
@@ -75,6 +77,9 @@ gint *rts_time_before_tx;
 gint *rts_time_after_tx;
 gint *echo;
 gint *crlfauto;
+gint *reader_thread;
+gint *buffer_size;
+gint *file_chunk;
 cfgList **macro_list = NULL;
 gchar **font;
 
@@ -83,6 +88,8 @@ gint *show_cursor;
 gint *rows;
 gint *columns;
 gint *scrollback;
+gint *refresh_rate;
+gint *render_limit;
 gint *visual_bell;
 gint *foreground_red;
 gint *foreground_blue;
@@ -106,6 +113,9 @@ cfgStruct cfg[] = {
     {"rs485_rts_time_after_tx", CFG_INT, &rts_time_after_tx},
     {"echo", CFG_BOOL, &echo},
     {"crlfauto", CFG_BOOL, &crlfauto},
+    {"reader_thread", CFG_BOOL, &reader_thread},
+    {"buffer_size", CFG_INT, &buffer_size},
+    {"file_chunk", CFG_INT, &file_chunk},
     {"font", CFG_STRING, &font},
     {"macros", CFG_STRING_LIST, &macro_list},
     {"term_transparency", CFG_BOOL, &transparency},
@@ -113,6 +123,8 @@ cfgStruct cfg[] = {
     {"term_rows", CFG_INT, &rows},
     {"term_columns", CFG_INT, &columns},
     {"term_scrollback", CFG_INT, &scrollback},
+    {"term_refresh_rate", CFG_INT, &refresh_rate},
+    {"term_render_limit", CFG_INT, &render_limit},
     {"term_visual_bell", CFG_BOOL, &visual_bell},
     {"term_foreground_red", CFG_INT, &foreground_red},
     {"term_foreground_blue", CFG_INT, &foreground_blue},
@@ -934,6 +946,21 @@ gint Load_configuration_from_file(gchar *config_name)
 		else
 		    config.crlfauto = FALSE;
 
+		if(reader_thread[i] != -1)
+		    config.reader_thread = (gboolean)reader_thread[i];
+		else
+		    config.reader_thread = FALSE;
+
+		if(buffer_size[i] != 0)
+		    config.buffer_size = buffer_size[i];
+		else
+		    config.buffer_size = DEFAULT_BUFFER_SIZE;
+
+		if(file_chunk[i] != 0)
+		    config.file_chunk = file_chunk[i];
+		else
+		    config.file_chunk = DEFAULT_FILE_CHUNK;
+
 		g_free(term_conf.font);
 		term_conf.font = g_strdup(font[i]);
 
@@ -996,6 +1023,13 @@ gint Load_configuration_from_file(gchar *config_name)
 		if(scrollback[i] != 0)
 		    term_conf.scrollback = scrollback[i];
 
+		if(refresh_rate[i] != 0)
+		    term_conf.refresh_rate = refresh_rate[i];
+		else
+		    term_conf.refresh_rate = DEFAULT_REFRESH_RATE;
+
+		term_conf.render_limit = render_limit[i];
+
 		if(visual_bell[i] != -1)
 		    term_conf.visual_bell = (gboolean)visual_bell[i];
 		else
@@ -1045,6 +1079,10 @@ gint Load_configuration_from_file(gchar *config_name)
 	    return -1;
 	}
     }
+    /* no terminal without window */
+    if(display == NULL)
+	return 0;
+
     vte_terminal_set_font_from_string(VTE_TERMINAL(display), term_conf.font);
 
     vte_terminal_set_background_transparent(VTE_TERMINAL(display), term_conf.transparency);
@@ -1106,6 +1144,38 @@ void Verify_configuration(void)
 	g_free(string);
     }
 
+    if(config.buffer_size < 1 || config.buffer_size > MAX_BUFFER_SIZE)
+    {
+	string = g_strdup_printf(_("Invalid buffer size: %d MB\nFalling back to default buffer size: %d MB\n"), config.buffer_size, DEFAULT_BUFFER_SIZE);
+	show_message(string, MSG_ERR);
+	config.buffer_size = DEFAULT_BUFFER_SIZE;
+	g_free(string);
+    }
+
+    if(config.file_chunk < 1 || config.file_chunk > MAX_FILE_CHUNK)
+    {
+	string = g_strdup_printf(_("Invalid file transfer chunk: %d KB\nFalling back to default chunk: %d KB\n"), config.file_chunk, DEFAULT_FILE_CHUNK);
+	show_message(string, MSG_ERR);
+	config.file_chunk = DEFAULT_FILE_CHUNK;
+	g_free(string);
+    }
+
+    if(term_conf.refresh_rate < 1 || term_conf.refresh_rate > 1000)
+    {
+	string = g_strdup_printf(_("Invalid refresh rate: %d Hz\nFalling back to default refresh rate: %d Hz\n"), term_conf.refresh_rate, DEFAULT_REFRESH_RATE);
+	show_message(string, MSG_ERR);
+	term_conf.refresh_rate = DEFAULT_REFRESH_RATE;
+	g_free(string);
+    }
+
+    if(term_conf.render_limit < 0 || term_conf.render_limit > MAX_RENDER_LIMIT)
+    {
+	string = g_strdup_printf(_("Invalid render limit: %d KB\nThe display is not limited\n"), term_conf.render_limit);
+	show_message(string, MSG_ERR);
+	term_conf.render_limit = 0;
+	g_free(string);
+    }
+
     if(term_conf.font == NULL)
 	term_conf.font = g_strdup_printf(DEFAULT_FONT);
 
@@ -1155,6 +1225,9 @@ void Hard_default_configuration(void)
     config.car = DEFAULT_CHAR;
     config.echo = DEFAULT_ECHO;
     config.crlfauto = FALSE;
+    config.reader_thread = FALSE;
+    config.buffer_size = DEFAULT_BUFFER_SIZE;
+    config.file_chunk = DEFAULT_FILE_CHUNK;
 
     term_conf.font = g_strdup_printf(DEFAULT_FONT);
 
@@ -1163,6 +1236,8 @@ void Hard_default_configuration(void)
     term_conf.rows = 80;
     term_conf.columns = 25;
     term_conf.scrollback = DEFAULT_SCROLLBACK;
+    term_conf.refresh_rate = DEFAULT_REFRESH_RATE;
+    term_conf.render_limit = 0;
     term_conf.visual_bell = TRUE;
 
     Selec_couleur(&term_conf.foreground_color, 0.66, 0.66, 0.66);
@@ -1262,6 +1337,22 @@ void Copy_configuration(int pos)
     cfgStoreValue(cfg, "crlfauto", string, CFG_INI, pos);
     g_free(string);
 
+    if(config.reader_thread == FALSE)
+	string = g_strdup_printf("False");
+    else
+	string = g_strdup_printf("True");
+
+    cfgStoreValue(cfg, "reader_thread", string, CFG_INI, pos);
+    g_free(string);
+
+    string = g_strdup_printf("%d", config.buffer_size);
+    cfgStoreValue(cfg, "buffer_size", string, CFG_INI, pos);
+    g_free(string);
+
+    string = g_strdup_printf("%d", config.file_chunk);
+    cfgStoreValue(cfg, "file_chunk", string, CFG_INI, pos);
+    g_free(string);
+
     string = g_strdup(term_conf.font);
     cfgStoreValue(cfg, "font", string, CFG_INI, pos);
     g_free(string);
@@ -1300,6 +1391,14 @@ void Copy_configuration(int pos)
     cfgStoreValue(cfg, "term_scrollback", string, CFG_INI, pos);
     g_free(string);
 
+    string = g_strdup_printf("%d", term_conf.refresh_rate);
+    cfgStoreValue(cfg, "term_refresh_rate", string, CFG_INI, pos);
+    g_free(string);
+
+    string = g_strdup_printf("%d", term_conf.render_limit);
+    cfgStoreValue(cfg, "term_render_limit", string, CFG_INI, pos);
+    g_free(string);
+
     if(term_conf.visual_bell == FALSE)
 	string = g_strdup_printf("False");
     else
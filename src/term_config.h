@@ -42,6 +42,9 @@ struct configuration_port {
   gchar car;             // caractere  attendre
   gboolean echo;               // echo local
   gboolean crlfauto;         // line feed auto
+  gboolean reader_thread;    // read the port from a dedicated thread
+  gint buffer_size;          // size of the history: in MB
+  gint file_chunk;           // file transfer chunk: in KB
 };
 
 typedef struct {
@@ -55,11 +58,15 @@ typedef struct {
   GdkColor background_color;
   gdouble background_saturation;
   gchar *font;
+  gint refresh_rate;           // max number of display updates per second
+  gint render_limit;           // max KB given to VTE per update, 0 : no limit
 } display_config_t;
 
 
 #define DEFAULT_FONT "FiraCode, 12"
 #define DEFAULT_SCROLLBACK 200
+#define DEFAULT_REFRESH_RATE 60
+#define MAX_RENDER_LIMIT 1024   /* in KB */
 
 #define DEFAULT_PORT "/dev/ttyACM0"
 #define DEFAULT_SPEED 9600
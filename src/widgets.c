@@ -64,12 +64,15 @@
 
 #include "term_config.h"
 #include "fichier.h"
+#include "hexparse.h"
 #include "serie.h"
 #include "widgets.h"
 #include "buffer.h"
 #include "macros.h"
 #include "auto_config.h"
 #include "logging.h"
+#include "hexview.h"
+#include "crlf.h"
 #include "detonator.h"
 
 #include <config.h>
@@ -80,6 +83,7 @@ gboolean echo_on;
 gboolean crlfauto_on;
 GtkWidget *StatusBar;
 GtkWidget *signals[6];
+static GtkWidget *counters_label = NULL;
 static GtkWidget *echo_menu = NULL;
 static GtkWidget *crlfauto_menu = NULL;
 static GtkWidget *ascii_menu = NULL;
@@ -101,17 +105,35 @@ GtkWidget *Text;
 GtkTextBuffer *buffer;
 GtkTextIter iter;
 
+/* Variables for the display render scheduler : the data is staged
+   and given to VTE at most once per frame */
+static GString *render_staging = NULL;
+static guint render_timer = 0;
+static gint64 render_window_start = 0;
+static guint render_chunks = 0;
+static guint render_feeds = 0;
+static guint render_chunks_per_second = 0;
+static guint render_feeds_per_second = 0;
+static gint render_cr_received = 0;
+static guint64 render_skipped = 0;
+static guint64 render_skipped_total = 0;
+
+/* What did not fit in the transmit queue, sent in order as soon as
+   there is room */
+static GString *send_pending = NULL;
+static guint callback_handler_send = 0;
+
+extern display_config_t term_conf;
+
 /* Variables for hexadecimal display */
 static gint bytes_per_line = 16;
-static gchar blank_data[128];
-static guint total_bytes;
 static gboolean show_index = FALSE;
+static hex_state_t hex_view;
 
 /* Local functions prototype */
 gint signaux(GtkWidget *, guint);
 gint a_propos(GtkWidget *, guint);
 gboolean Envoie_car(GtkWidget *, GdkEventKey *, gpointer);
-gboolean control_signals_read(void);
 gint Toggle_Echo(gpointer *, guint, GtkWidget *);
 gint Toggle_Crlfauto(gpointer *, guint, GtkWidget *);
 gint view(gpointer *, guint, GtkWidget *);
@@ -126,6 +148,13 @@ static void Got_Input(VteTerminal *, gchar *, guint, gpointer);
 gint gui_paste(void);
 gint gui_copy(void);
 gint gui_copy_all_clipboard(void);
+gint show_reader_stats(void);
+gint show_display_stats(void);
+gint show_copy_stats(void);
+gint show_tx_stats(void);
+static gboolean render_timeout(gpointer);
+static GString *display_staging(void);
+static void display_schedule(void);
 
 
 /* Menu */
@@ -136,6 +165,7 @@ static GtkItemFactoryEntry Tableau_Menu[] = {
   {N_("/_File") , NULL, NULL, 0, "<Branch>"},
   {N_("/File/Clear screen") , "<ctrl><shift>L", (GtkItemFactoryCallback)clear_buffer, 0, "<StockItem>", GTK_STOCK_CLEAR},
   {N_("/File/Send _raw file") , "<ctrl><shift>R", (GtkItemFactoryCallback)fichier, 1, "<StockItem>",GTK_STOCK_JUMP_TO},
+  {N_("/File/Send _hexadecimal file") , NULL, (GtkItemFactoryCallback)fichier, 3, "<StockItem>",GTK_STOCK_JUMP_TO},
   {N_("/File/_Save raw file") , NULL, (GtkItemFactoryCallback)fichier, 2, "<StockItem>", GTK_STOCK_SAVE_AS},
   {N_("/File/Separator") , NULL, NULL, 0, "<Separator>"},
   {N_("/File/E_xit") , "<ctrl><shift>Q", gtk_main_quit, 0, "<StockItem>", GTK_STOCK_QUIT},
@@ -175,6 +205,10 @@ static GtkItemFactoryEntry Tableau_Menu[] = {
   {N_("/View/_Send hexadecimal data") , NULL, (GtkItemFactoryCallback)show_hide_hex, 0, "<CheckItem>"},
   {N_("/_Debugging"), NULL, NULL, 0, "<Branch>"},
   {N_("/Debugging/_Detonator"), NULL, (GtkItemFactoryCallback)portDetonate, 0, "<StockItem>"},
+  {N_("/Debugging/_Reader statistics"), NULL, (GtkItemFactoryCallback)show_reader_stats, 0, "<Item>"},
+  {N_("/Debugging/Display _statistics"), NULL, (GtkItemFactoryCallback)show_display_stats, 0, "<Item>"},
+  {N_("/Debugging/_Copy statistics"), NULL, (GtkItemFactoryCallback)show_copy_stats, 0, "<Item>"},
+  {N_("/Debugging/_Transmit statistics"), NULL, (GtkItemFactoryCallback)show_tx_stats, 0, "<Item>"},
   {N_("/_Help"), NULL, NULL, 0, "<LastBranch>"},
   {N_("/Help/_About..."), NULL, (GtkItemFactoryCallback)a_propos, 0, "<StockItem>", GTK_STOCK_DIALOG_INFO}
 };
@@ -219,7 +253,6 @@ void set_view(guint type)
       gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(ascii_menu), TRUE);
       gtk_widget_set_sensitive(GTK_WIDGET(show_index_menu), FALSE);
       gtk_widget_set_sensitive(GTK_WIDGET(hex_chars_menu), FALSE);
-      total_bytes = 0;
       set_display_func(put_text);
       break;
     case HEXADECIMAL_VIEW:
@@ -227,7 +260,6 @@ void set_view(guint type)
       gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(ascii_menu), FALSE);
       gtk_widget_set_sensitive(GTK_WIDGET(show_index_menu), TRUE);
       gtk_widget_set_sensitive(GTK_WIDGET(hex_chars_menu), TRUE);
-      total_bytes = 0;
       set_display_func(put_hexadecimal);
       break;
     default:
@@ -276,6 +308,9 @@ gint Toggle_Crlfauto(gpointer *pointer, guint param, GtkWidget *widget)
 
 void toggle_logging_pause_resume(gboolean currentlyLogging)
 {
+    if (log_pause_resume_menu == NULL)
+        return;
+
     if (currentlyLogging)
     {
         gtk_menu_item_set_label(GTK_MENU_ITEM(log_pause_resume_menu), _("Pause"));
@@ -288,6 +323,9 @@ void toggle_logging_pause_resume(gboolean currentlyLogging)
 
 void toggle_logging_sensitivity(gboolean currentlyLogging)
 {
+   if (log_start_menu == NULL)
+      return;
+
    gtk_widget_set_sensitive(GTK_WIDGET(log_start_menu), !currentlyLogging);
    gtk_widget_set_sensitive(GTK_WIDGET(log_stop_menu), currentlyLogging);
    gtk_widget_set_sensitive(GTK_WIDGET(log_pause_resume_menu), currentlyLogging);
@@ -409,9 +447,14 @@ void create_main_window(void)
   gtk_box_pack_end(GTK_BOX(StatusBar), Label, FALSE, TRUE, 5);
   signals[5] = Label;
 
-  g_signal_connect_after(GTK_OBJECT(display), "commit", G_CALLBACK(Got_Input), NULL);
+  counters_label = gtk_label_new("");
+  gtk_widget_set_tooltip_text(counters_label,
+			      _("Receive and transmit rates and totals since the port was opened.\n"
+				"UART errors from the driver : OE overrun (FIFO full), BO buffer overrun "
+				"(tty buffer full), FE framing, PE parity, BRK breaks"));
+  gtk_box_pack_end(GTK_BOX(StatusBar), counters_label, FALSE, TRUE, 5);
 
-  gtk_timeout_add(POLL_DELAY, (GtkFunction)control_signals_read, NULL);
+  g_signal_connect_after(GTK_OBJECT(display), "commit", G_CALLBACK(Got_Input), NULL);
 
   gtk_window_set_default_size(GTK_WINDOW(Fenetre), 750, 550);
   gtk_widget_show_all(Fenetre);
@@ -421,92 +464,176 @@ void create_main_window(void)
 
 void initialize_hexadecimal_display(void)
 {
-  total_bytes = 0;
-  memset(blank_data, ' ', 128);
-  blank_data[bytes_per_line * 3 + 5] = 0;
+  hex_init(&hex_view, bytes_per_line, show_index);
 }
 
 void put_hexadecimal(gchar *string, guint size)
 {
-  static gchar data[128];
-  static gchar data_byte[6];
-  static guint bytes;
-  glong column, row;
-
-  gint i = 0;
-
   if(size == 0)
     return;
 
-  while(i < size)
+  /* formatted straight into the staging buffer */
+  hex_format(&hex_view, (guchar *)string, size, display_staging());
+  buffer_count_copy(size);
+  display_schedule();
+}
+
+static void render_count(guint chunks, guint feeds)
+{
+    gint64 now = g_get_monotonic_time();
+
+    render_chunks += chunks;
+    render_feeds += feeds;
+
+    if(now - render_window_start >= G_USEC_PER_SEC)
+    {
+	render_chunks_per_second = render_chunks;
+	render_feeds_per_second = render_feeds;
+	render_chunks = 0;
+	render_feeds = 0;
+	render_window_start = now;
+    }
+}
+
+/* Above term_conf.render_limit KB, only the most recent tail of the
+   staging buffer is kept for VTE. The history and the log have already
+   got every byte : only the screen misses some */
+static void display_shed(gsize limit)
+{
+    gsize skipped;
+    gchar *line;
+
+    if(term_conf.render_limit == 0 || render_staging->len <= limit)
+	return;
+
+    /* the tail starts on a new line, or else at least on a UTF-8
+       character, where the rest of an escape sequence would only show
+       as text. The marker cancels (CAN) a sequence left open by the
+       data already given to VTE and resets the attributes */
+    skipped = render_staging->len - limit;
+    line = memchr(render_staging->str + skipped, '\n', limit);
+    if(line != NULL)
+	skipped = line + 1 - render_staging->str;
+    else
+    {
+	line = g_utf8_find_next_char(render_staging->str + skipped - 1,
+				     render_staging->str + render_staging->len);
+	skipped = (line != NULL) ? (gsize)(line - render_staging->str) : render_staging->len;
+    }
+
+    g_string_erase(render_staging, 0, skipped);
+    render_skipped += skipped;
+}
+
+void display_flush(void)
+{
+    gchar *marker, *text;
+
+    if(render_timer != 0)
+    {
+	g_source_remove(render_timer);
+	render_timer = 0;
+    }
+
+    if(render_staging == NULL || render_staging->len == 0)
+	return;
+
+    /* no window : nothing to render */
+    if(display == NULL)
+    {
+	g_string_truncate(render_staging, 0);
+	return;
+    }
+
+    display_shed((gsize)term_conf.render_limit * 1024);
+    if(render_skipped != 0)
     {
-      while(gtk_events_pending()) gtk_main_iteration();
-      vte_terminal_get_cursor_position(VTE_TERMINAL(display), &column, &row);
-
-      if(show_index)
-	{
-	  if(column == 0)
-	    /* First byte on line */
-	    {
-	      sprintf(data, "%6d: ", total_bytes);
-	      vte_terminal_feed(VTE_TERMINAL(display), data, strlen(data));
-	      bytes = 0;
-	    }
-	}
-      else
-	{
-	  if(column == 0)
-	    bytes = 0;
-	}
-
-      /* Print hexadecimal characters */
-      data[0] = 0;
-
-      while(bytes < bytes_per_line && i < size)
-	{
-	  gint avance=0;
-	  gchar ascii[1];
-
-	  sprintf(data_byte, "%02X ", (guchar)string[i]);
-	  log_chars(data_byte, 3);
-	  vte_terminal_feed(VTE_TERMINAL(display), data_byte, 3);
-
-	  avance = (bytes_per_line - bytes) * 3 + bytes + 2;
-
-	  /* Move forward */
-	  sprintf(data_byte, "%c[%dC", 27, avance);
-	  vte_terminal_feed(VTE_TERMINAL(display), data_byte, strlen(data_byte));
-
-	  /* Print ascii characters */
-	  ascii[0] = (string[i] > 0x1F) ? string[i] : '.';
-	  vte_terminal_feed(VTE_TERMINAL(display), ascii, 1);
-
-	  /* Move backward */
-	  sprintf(data_byte, "%c[%dD", 27, avance + 1);
-	  vte_terminal_feed(VTE_TERMINAL(display), data_byte, strlen(data_byte));
-
-	  if(bytes == bytes_per_line / 2 - 1)
-	    vte_terminal_feed(VTE_TERMINAL(display), "- ", strlen("- "));
-
-	  bytes++;
-	  i++;
-
-	  /* End of line ? */
-	  if(bytes == bytes_per_line)
-	    {
-	      vte_terminal_feed(VTE_TERMINAL(display), "\r\n", 2);
-	      total_bytes += bytes;
-	    }
-
-	}
+	text = g_strdup_printf(_("[%llu bytes not rendered]"), (unsigned long long)render_skipped);
+	marker = g_strdup_printf("\030\033[0m\r\n\033[7m%s\033[0m\r\n", text);
+	vte_terminal_feed(VTE_TERMINAL(display), marker, strlen(marker));
+	g_free(marker);
+	g_free(text);
+	render_skipped_total += render_skipped;
+	render_skipped = 0;
+    }
+
+    vte_terminal_feed(VTE_TERMINAL(display), render_staging->str, render_staging->len);
+    g_string_truncate(render_staging, 0);
+    render_count(0, 1);
+}
+
+static gboolean render_timeout(gpointer data)
+{
+    render_timer = 0;
+    display_flush();
+
+    return FALSE;
+}
+
+static GString *display_staging(void)
+{
+    if(render_staging == NULL)
+	render_staging = g_string_sized_new(BUFFER_RECEPTION);
+
+    return render_staging;
+}
+
+/* Data was added to the staging buffer : make sure the next frame
+   comes */
+static void display_schedule(void)
+{
+    gsize limit = (gsize)term_conf.render_limit * 1024;
+
+    render_count(1, 0);
+
+    /* flooded between two frames : the staging buffer stays bounded.
+       It is only cut down to the limit once it has reached twice the
+       limit, so that each byte is moved at most once */
+    if(render_staging->len > limit * 2)
+	display_shed(limit);
+
+    if(render_timer == 0)
+	render_timer = g_timeout_add(1000 / term_conf.refresh_rate, render_timeout, NULL);
+}
 
+/* Queue data for the terminal : it is fed to VTE by the next frame */
+void display_feed(gchar *string, guint size)
+{
+    g_string_append_len(display_staging(), string, size);
+    display_schedule();
+}
+
+static void display_discard(void)
+{
+    if(render_timer != 0)
+    {
+	g_source_remove(render_timer);
+	render_timer = 0;
     }
+
+    if(render_staging != NULL)
+	g_string_truncate(render_staging, 0);
+    render_cr_received = 0;
+    render_skipped = 0;
 }
 
+/* The buffer keeps the raw data : the CR LF auto mode is applied here,
+   straight into the staging buffer */
 void put_text(gchar *string, guint size)
 {
-    log_chars(string, size);
-    vte_terminal_feed(VTE_TERMINAL(display), string, size);
+    GString *staging = display_staging();
+    gsize length = staging->len;
+
+    if(crlfauto_on)
+    {
+	g_string_set_size(staging, length + size * 2);
+	g_string_truncate(staging, length + crlf_convert(string, size, staging->str + length, &render_cr_received));
+    }
+    else
+	g_string_append_len(staging, string, size);
+    buffer_count_copy(size);
+
+    display_schedule();
 }
 
 gint send_serial(gchar *string, gint len)
@@ -517,24 +644,85 @@ gint send_serial(gchar *string, gint len)
   if(bytes_written > 0)
   {
     /// Trace to STD OUT
-    printf("--> [%s]\n", string);
+    if(trace_on_stdout == TRUE)
+      printf("--> [%.*s]\n", bytes_written, string);
     if(echo_on)
-      put_chars(string, bytes_written, crlfauto_on);
+    {
+      put_chars(string, bytes_written);
+      /* keyboard echo must not wait for the next frame */
+      display_flush();
+    }
   }
 
   return bytes_written;
 }
 
 
+/* Sends what is pending, FALSE if the queue is still full */
+static gboolean send_pending_flush(void)
+{
+  gint queued;
+
+  if(send_pending == NULL || send_pending->len == 0)
+    return TRUE;
+  /* the port is closed : nothing will ever take it */
+  if(serial_port_fd == -1)
+  {
+    g_string_truncate(send_pending, 0);
+    return TRUE;
+  }
+
+  queued = send_serial(send_pending->str, send_pending->len);
+  g_string_erase(send_pending, 0, MAX(queued, 0));
+
+  return send_pending->len == 0;
+}
+
+static gboolean send_retry(gpointer data)
+{
+  if(send_pending_flush() == FALSE)
+    return TRUE;
+
+  callback_handler_send = 0;
+  return FALSE;
+}
+
+/* Like send_serial(), but what does not fit in the transmit queue is
+   kept and sent later : for the keyboard, the macros and the hexadecimal
+   sends, which must neither wait for the port nor lose anything */
+void send_serial_all(gchar *string, gint len)
+{
+  gint queued = 0;
+
+  if(len <= 0)
+    return;
+  if(send_pending == NULL)
+    send_pending = g_string_new(NULL);
+
+  /* after what is already waiting */
+  if(send_pending->len == 0)
+    queued = MAX(send_serial(string, len), 0);
+  if(queued == len || serial_port_fd == -1)
+    return;
+
+  g_string_append_len(send_pending, string + queued, len - queued);
+  if(callback_handler_send == 0)
+    callback_handler_send = g_timeout_add(SEND_RETRY, send_retry, NULL);
+}
+
+/* Keys come one by one, a paste arrives in one piece */
 static void Got_Input(VteTerminal *widget, gchar *text, guint length, gpointer ptr)
 {
-  send_serial(text, length);
+  if(length > PASTE_DIRECT)
+    send_paste(text, length);
+  else
+    send_serial_all(text, length);
 }
 
 gboolean Envoie_car(GtkWidget *widget, GdkEventKey *event, gpointer pointer)
 {
   if(g_utf8_validate(event->string, 1, NULL))
-    send_serial(event->string, 1);
+    send_serial_all(event->string, 1);
 
   return FALSE;
 }
@@ -558,6 +746,9 @@ gint a_propos(GtkWidget *widget, guint param)
 
 void show_control_signals(int stat)
 {
+  if(signals[0] == NULL)
+    return;
+
   if(stat & TIOCM_RI)
     gtk_widget_set_sensitive(GTK_WIDGET(signals[0]), TRUE);
   else
@@ -607,28 +798,73 @@ void show_control_signals(int stat)
   }
 }
 
+static void format_size(gchar *text, gsize length, guint64 bytes)
+{
+  if(bytes < 1024)
+    g_snprintf(text, length, "%u B", (guint)bytes);
+  else if(bytes < 1024 * 1024)
+    g_snprintf(text, length, "%.1f KB", bytes / 1024.0);
+  else if(bytes < 1024 * 1024 * 1024)
+    g_snprintf(text, length, "%.1f MB", bytes / (1024.0 * 1024));
+  else
+    g_snprintf(text, length, "%.2f GB", bytes / (1024.0 * 1024 * 1024));
+}
+
+/* Called once per second. Any UART error turns the counters red */
+void show_port_counters(void)
+{
+  port_counters_t values;
+  gchar rx_rate[16], rx_total[16], tx_rate[16], tx_total[16];
+  gchar *text, *errors;
+
+  if(counters_label == NULL)
+    return;
+
+  get_port_counters(&values);
+  format_size(rx_rate, sizeof(rx_rate), values.rx_rate);
+  format_size(rx_total, sizeof(rx_total), values.rx_bytes);
+  format_size(tx_rate, sizeof(tx_rate), values.tx_rate);
+  format_size(tx_total, sizeof(tx_total), values.tx_bytes);
+
+  if(values.uart_valid)
+    errors = g_strdup_printf(" OE:%u BO:%u FE:%u PE:%u BRK:%u",
+			     values.overrun, values.buf_overrun,
+			     values.frame, values.parity, values.brk);
+  else
+    errors = g_strdup("");
+
+  if(values.overrun != 0 || values.buf_overrun != 0 || values.frame != 0 || values.parity != 0)
+    text = g_markup_printf_escaped("<span foreground=\"red\">RX %s/s %s  TX %s/s %s%s</span>",
+				   rx_rate, rx_total, tx_rate, tx_total, errors);
+  else
+    text = g_markup_printf_escaped("RX %s/s %s  TX %s/s %s%s",
+				   rx_rate, rx_total, tx_rate, tx_total, errors);
+  gtk_label_set_markup(GTK_LABEL(counters_label), text);
+
+  g_free(text);
+  g_free(errors);
+}
+
 gint signaux(GtkWidget *widget, guint param)
 {
+  int state;
+
   if(param == 2)
     {
       sendbreak();
       Put_temp_message(_("Break signal sent!"), 800);
     }
   else
-    Set_signals(param);
+    {
+      Set_signals(param);
+      /* the monitor only reports the input lines */
+      state = lis_sig();
+      if(state >= 0)
+	show_control_signals(state);
+    }
   return FALSE;
 }
 
-gboolean control_signals_read(void)
-{
-  int state;
-
-  state = lis_sig();
-  if(state >= 0)
-    show_control_signals(state);
-
-  return TRUE;
-}
 
 void Set_status_message(gchar *msg)
 {
@@ -647,6 +883,15 @@ void show_message(gchar *message, gint type_msg)
 {
  GtkWidget *Fenetre_msg;
 
+ /* no window to show it */
+ if(Fenetre == NULL)
+   {
+     fprintf(stderr, "%s", message);
+     if(message[0] != 0 && message[strlen(message) - 1] != '\n')
+       fprintf(stderr, "\n");
+     return;
+   }
+
  if(type_msg==MSG_ERR)
    {
      Fenetre_msg = gtk_message_dialog_new(GTK_WINDOW(Fenetre), 
@@ -672,13 +917,15 @@ void show_message(gchar *message, gint type_msg)
 
 gboolean Send_Hexadecimal(GtkWidget *widget, GdkEventKey *event, gpointer pointer)
 {
-    guint i;
-    gchar *text, *message, **tokens, *buff;
-    guint scan_val;
+    gchar *text, *message, *buff;
+    gsize length;
+    gssize decoded;
+    hexparse_t parser;
 
     text = (gchar *)gtk_entry_get_text(GTK_ENTRY(widget));
+    length = strlen(text);
 
-    if(strlen(text) == 0){
+    if(length == 0){
         message = g_strdup_printf(_("0 byte(s) sent!"));
         Put_temp_message(message, 1500);
         gtk_entry_set_text(GTK_ENTRY(widget), "");
@@ -686,32 +933,35 @@ gboolean Send_Hexadecimal(GtkWidget *widget, GdkEventKey *event, gpointer pointe
         return FALSE;
     }
 
-    tokens = g_strsplit_set(text, " ;", -1);
-    buff = g_malloc(g_strv_length(tokens));
-
-    for(i = 0; tokens[i] != NULL; i++){
-        if(sscanf(tokens[i], "%02X", &scan_val) != 1){
-            Put_temp_message(_("Improperly formatted hex input, 0 bytes sent!"),
-                             1500);
-            g_free(buff);
-            return FALSE;
-        }
-        buff[i] = scan_val;
+    buff = g_malloc(length / 2 + 2);
+    hexparse_init(&parser);
+    decoded = hexparse_feed(&parser, text, length, buff);
+    if(decoded == -1){
+        message = g_strdup_printf(_("Improperly formatted hex input at position %lu, 0 bytes sent!"),
+                                  (gulong)parser.position + 1);
+        Put_temp_message(message, 1500);
+        g_free(message);
+        g_free(buff);
+        return FALSE;
     }
+    decoded += hexparse_finish(&parser, buff + decoded);
 
-    send_serial(buff, i);
+    send_serial_all(buff, decoded);
     g_free(buff);
 
-    message = g_strdup_printf(_("%d byte(s) sent!"), i);
+    message = g_strdup_printf(_("%d byte(s) sent!"), (gint)decoded);
     Put_temp_message(message, 2000);
     gtk_entry_set_text(GTK_ENTRY(widget), "");
-    g_strfreev(tokens);
+    g_free(message);
 
     return FALSE;
 }
 
 void Put_temp_message(const gchar *text, gint time)
 {
+  if(StatusBar == NULL)
+    return;
+
   /* time in ms */
   gtk_statusbar_push(GTK_STATUSBAR(StatusBar), id, text);
   gtk_timeout_add(time, (GtkFunction)pop_message, NULL);
@@ -726,6 +976,7 @@ gboolean pop_message(void)
 
 void clear_display(void)
 {
+  display_discard();
   initialize_hexadecimal_display();
   if(display)
     vte_terminal_reset(VTE_TERMINAL(display), TRUE, TRUE);
@@ -743,6 +994,57 @@ gint gui_copy(void)
     return 0;
 }
 
+gint show_reader_stats(void)
+{
+    gchar *stats;
+
+    stats = get_reader_stats();
+    Put_temp_message(stats, 5000);
+    g_free(stats);
+
+    return 0;
+}
+
+gint show_display_stats(void)
+{
+    gchar *stats;
+
+    /* refresh the rates if nothing was received for a while */
+    render_count(0, 0);
+
+    stats = g_strdup_printf(_("Display: %u chunks/s received, %u VTE feeds/s (max %d), %llu bytes not rendered"),
+			    render_chunks_per_second,
+			    render_feeds_per_second,
+			    term_conf.refresh_rate,
+			    (unsigned long long)render_skipped_total);
+    Put_temp_message(stats, 5000);
+    g_free(stats);
+
+    return 0;
+}
+
+gint show_copy_stats(void)
+{
+    gchar *stats;
+
+    stats = get_copy_stats();
+    Put_temp_message(stats, 5000);
+    g_free(stats);
+
+    return 0;
+}
+
+gint show_tx_stats(void)
+{
+    gchar *stats;
+
+    stats = get_tx_stats();
+    Put_temp_message(stats, 5000);
+    g_free(stats);
+
+    return 0;
+}
+
 gint gui_copy_all_clipboard(void)
 {
     vte_terminal_select_all(VTE_TERMINAL(display));
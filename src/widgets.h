@@ -21,15 +21,22 @@
 #define ASCII_VIEW 0
 #define HEXADECIMAL_VIEW 1
 
+#define SEND_RETRY 10         /* in ms (transmit queue full) */
+
 void create_main_window(void);
 void Set_status_message(gchar *);
 void put_text(gchar *, guint);
+void display_feed(gchar *, guint);
+void display_flush(void);
 void put_hexadecimal(gchar *, guint);
 void Set_local_echo(gboolean);
+void show_control_signals(int);
+void show_port_counters(void);
 void show_message(gchar *, gint);
 void clear_display(void);
 void set_view(guint);
 gint send_serial(gchar *, gint);
+void send_serial_all(gchar *, gint);
 void Put_temp_message(const gchar *, gint);
 void Set_window_title(gchar *msg);
 